@@ -0,0 +1,1016 @@
+//////////////////////////////////////////////////////////
+// bench - timings for the config_edit building blocks.
+//
+//  ./bench [--lines n] [--sections n] [--depth n] [--gpios n]
+//          [--serials n] [--seed n] [--iterations n] [--json] [lines]
+//
+//  Runs against a generated config.txt (see Corpus).  Results are
+//  printed as a table, or with --json as one json document on
+//  stdout (the table then goes to stderr).
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include "config_edit.h"
+#include "config_server.h"
+
+//////////////////////////////////////////////////////////
+// allocation counting - every operator new in the process, from
+// any thread (the server bench serves from a second one).
+static std::atomic< size_t > gAllocations( 0 );
+static void * countedAlloc( size_t size, size_t alignment )
+{
+  gAllocations.fetch_add( 1, std::memory_order_relaxed );
+  if( size == 0 ) size = 1;
+  void * p;
+  if( alignment <= alignof( std::max_align_t ) ){
+    p = std::malloc( size );
+  } else {
+    // aligned_alloc wants a multiple of the alignment.
+    p = std::aligned_alloc( alignment,
+			    ( size + alignment - 1 ) / alignment * alignment );
+  }
+  if( p == nullptr ) throw std::bad_alloc();
+  return p;
+}
+void * operator new( size_t size )
+{
+  return countedAlloc( size, 0 );
+}
+void * operator new[]( size_t size )
+{
+  return countedAlloc( size, 0 );
+}
+void * operator new( size_t size, std::align_val_t alignment )
+{
+  return countedAlloc( size, size_t( alignment ) );
+}
+void * operator new[]( size_t size, std::align_val_t alignment )
+{
+  return countedAlloc( size, size_t( alignment ) );
+}
+void operator delete( void * p ) noexcept
+{
+  std::free( p );
+}
+void operator delete[]( void * p ) noexcept
+{
+  std::free( p );
+}
+void operator delete( void * p, size_t ) noexcept
+{
+  std::free( p );
+}
+void operator delete[]( void * p, size_t ) noexcept
+{
+  std::free( p );
+}
+void operator delete( void * p, std::align_val_t ) noexcept
+{
+  std::free( p );
+}
+void operator delete[]( void * p, std::align_val_t ) noexcept
+{
+  std::free( p );
+}
+void operator delete( void * p, size_t, std::align_val_t ) noexcept
+{
+  std::free( p );
+}
+void operator delete[]( void * p, size_t, std::align_val_t ) noexcept
+{
+  std::free( p );
+}
+
+static const char * defaultSchema = defaultConfigJson.data();
+
+//////////////////////////////////////////////////////////
+// Results - every figure taken, by group and benchmark name.
+// Each is printed as it is recorded, and writeJson() gives them all
+// as one document for tools comparing runs.
+struct Figure
+{
+  const char * mUnit;
+  double mValue;
+};
+class Results
+{
+  struct Entry {
+    std::string mGroup;
+    std::string mName;
+    std::vector< Figure > mFigures;
+  };
+  std::vector< Entry > mEntries;
+  std::string mGroup;
+  FILE * mTable;
+public:
+  Results()
+    : mTable( stdout )
+  {}
+  void tableTo( FILE * table )
+  {
+    mTable = table;
+  }
+  // following records belong to group, heading describes it.
+  void group( const char * group, const std::string & heading )
+  {
+    mGroup = group;
+    fprintf( mTable, "%s\n", heading.c_str() );
+  }
+  void record( const std::string & name, std::vector< Figure > figures )
+  {
+    fprintf( mTable, "%-28s", name.c_str() );
+    for( auto it = figures.begin(); it != figures.end(); it++ ){
+      fprintf( mTable, " %12.2f %s", it->mValue, it->mUnit );
+    }
+    fprintf( mTable, "\n" );
+    mEntries.push_back( Entry{ mGroup, name, std::move( figures ) } );
+  }
+  void writeJson( json_lite::Writer & writer ) const
+  {
+    writer.StartArray();
+    for( auto it = mEntries.begin(); it != mEntries.end(); it++ ){
+      writer.StartObject();
+      writer.Key( "group" );
+      writer.String( it->mGroup );
+      writer.Key( "name" );
+      writer.String( it->mName );
+      for( auto fig = it->mFigures.begin(); fig != it->mFigures.end(); fig++ ){
+	writer.Key( fig->mUnit );
+	writer.Double( fig->mValue );
+      }
+      writer.EndObject();
+    }
+    writer.EndArray();
+  }
+};
+static Results gResults;
+
+class Measure
+{
+  std::chrono::steady_clock::time_point mStart;
+  size_t mAllocations;
+public:
+  Measure()
+    : mStart( std::chrono::steady_clock::now() )
+    , mAllocations( gAllocations )
+  {}
+  // extra - per iteration figures the benchmark counted itself.
+  void report( const char * name, size_t iterations,
+	       std::vector< Figure > extra = {} )
+  {
+    double us = std::chrono::duration<double, std::micro>(
+		  std::chrono::steady_clock::now() - mStart ).count();
+    std::vector< Figure > figures{
+      { "us/iter", us / iterations },
+      { "allocs/iter", double( gAllocations - mAllocations ) / iterations } };
+    figures.insert( figures.end(), extra.begin(), extra.end() );
+    gResults.record( name, std::move( figures ) );
+  }
+};
+
+//////////////////////////////////////////////////////////
+// streambuf which writes to a file descriptor the way filebuf
+// does, counting the write calls std::endl causes.
+class CountingBuf : public std::streambuf
+{
+  int mFd;
+  char mBuffer[ 4096 ];
+public:
+  size_t mWriteCalls;
+  CountingBuf( int fd )
+    : mFd( fd )
+    , mWriteCalls( 0 )
+  {
+    setp( mBuffer, mBuffer + sizeof( mBuffer ) );
+  }
+  int sync() override
+  {
+    if( pptr() != pbase() ){
+      mWriteCalls++;
+      if( write( mFd, pbase(), pptr() - pbase() ) < 0 ) return -1;
+      setp( mBuffer, mBuffer + sizeof( mBuffer ) );
+    }
+    return 0;
+  }
+  int overflow( int ch ) override
+  {
+    if( sync() != 0 ) return traits_type::eof();
+    if( ch != traits_type::eof() ){
+      *pptr() = ch;
+      pbump( 1 );
+    }
+    return ch;
+  }
+};
+
+//////////////////////////////////////////////////////////
+// accepts any document, counting the events.
+class CountingHandler : public json_lite::ReaderHandlerAllFail
+{
+public:
+  size_t mEvents;
+  CountingHandler()
+    : mEvents( 0 )
+  {}
+  bool Null() { mEvents++; return true; }
+  bool Int( int ) { mEvents++; return true; }
+  bool Uint( unsigned ) { mEvents++; return true; }
+  bool Int64( int64_t ) { mEvents++; return true; }
+  bool Uint64( uint64_t ) { mEvents++; return true; }
+  bool Double( double ) { mEvents++; return true; }
+  bool Bool( bool ) { mEvents++; return true; }
+  bool String( const char *, size_t ) { mEvents++; return true; }
+  bool Key( const char *, size_t ) { mEvents++; return true; }
+  bool StartObject() { mEvents++; return true; }
+  bool EndObject() { mEvents++; return true; }
+  bool StartArray() { mEvents++; return true; }
+  bool EndArray() { mEvents++; return true; }
+};
+
+// a schema shaped document - classes of filter values.
+// dense - short tokens and no whitespace, so the cost is in the
+// grammar rather than the scanning.
+static std::string makeSchema( size_t classes, bool dense = false )
+{
+  std::string text = dense ? "{" : "{\n";
+  for( size_t i = 0; i < classes; i++ ){
+    text += i ? ( dense ? "," : ",\n" ) : "";
+    text += ( dense ? "\"c" : "  \"class_" ) + std::to_string( i ) +
+      ( dense ? "\":[" : "\" : [ " );
+    for( size_t v = 0; v < 8; v++ ){
+      text += v ? ( dense ? "," : ", " ) : "";
+      text += dense ? "\"v\",true,null" :
+	"\"value_" + std::to_string( i * 8 + v ) + "\"";
+    }
+    text += dense ? "]" : ", true, null ]";
+  }
+  text += dense ? "}" : "\n}";
+  return text;
+}
+
+// classes of numeric values - integers of each width, and doubles.
+static std::string makeNumbers( size_t classes )
+{
+  static const char * values[] = { "0", "-17", "4096", "3000000000",
+				   "-5000000000", "18000000000000000000",
+				   "2.5", "-1.25e-3", "6.02214076e23" };
+  std::string text = "{";
+  for( size_t i = 0; i < classes; i++ ){
+    text += i ? ",\n" : "\n";
+    text += "  \"class_" + std::to_string( i ) + "\" : [ ";
+    for( size_t v = 0; v < 9; v++ ){
+      text += v ? ", " : "";
+      text += values[ v ];
+    }
+    text += " ]";
+  }
+  text += "\n}";
+  return text;
+}
+
+template< class Reader, class Stream >
+static void benchJson( const char * name, const std::string & text,
+		       size_t iterations,
+		       const json_lite::scan::Kernels * kernels = nullptr )
+{
+  size_t events = 0;
+  size_t allocations = gAllocations;
+  auto start = std::chrono::steady_clock::now();
+  for( size_t i = 0; i < iterations; i++ ){
+    CountingHandler handler;
+    Stream stream( text.c_str() );
+    Reader rdr( handler, stream, true );
+    if( kernels ){
+      rdr.useKernels( *kernels );
+    }
+    if( rdr.read( true ) == false ){
+      printf( "%s failed\n", name );
+      return;
+    }
+    events += handler.mEvents;
+  }
+  double ns = std::chrono::duration<double, std::nano>(
+		std::chrono::steady_clock::now() - start ).count();
+  allocations = gAllocations - allocations;
+  gResults.record( name, { { "ns/byte", ns / ( iterations * text.size() ) },
+			   { "MB/s", iterations * text.size() * 1e3 / ns },
+			   { "ns/event", ns / events },
+			   { "allocs/event", (double)allocations / events } } );
+}
+
+// the document read straight into a Writer, so json out per byte in.
+static void benchWriter( const char * name, const std::string & text,
+			 size_t iterations )
+{
+  std::string out;
+  size_t allocations = gAllocations;
+  auto start = std::chrono::steady_clock::now();
+  for( size_t i = 0; i < iterations; i++ ){
+    out.clear();
+    json_lite::Writer writer( out );
+    json_lite::BufferInputStream stream( text );
+    json_lite::BufferReader rdr( writer, stream, true );
+    if( rdr.read( true ) == false ){
+      printf( "%s failed\n", name );
+      return;
+    }
+  }
+  double ns = std::chrono::duration<double, std::nano>(
+		std::chrono::steady_clock::now() - start ).count();
+  allocations = gAllocations - allocations;
+  gResults.record( name, { { "ns/byte", ns / ( iterations * text.size() ) },
+			   { "MB/s", iterations * text.size() * 1e3 / ns },
+			   { "bytes out", double( out.size() ) },
+			   { "allocs/iter", (double)allocations / iterations } } );
+}
+
+// the document pushed in chunk sized pieces.
+static void benchPush( const char * name, const std::string & text,
+		       size_t chunk, size_t iterations )
+{
+  size_t events = 0;
+  size_t allocations = gAllocations;
+  auto start = std::chrono::steady_clock::now();
+  for( size_t i = 0; i < iterations; i++ ){
+    CountingHandler handler;
+    json_lite::PushParser parser( handler );
+    for( size_t pos = 0; pos < text.size(); pos += chunk ){
+      parser.feed( text.data() + pos, std::min( chunk, text.size() - pos ) );
+    }
+    if( parser.finish() == false ){
+      printf( "%s failed\n", name );
+      return;
+    }
+    events += handler.mEvents;
+  }
+  double ns = std::chrono::duration<double, std::nano>(
+		std::chrono::steady_clock::now() - start ).count();
+  allocations = gAllocations - allocations;
+  gResults.record( name, { { "ns/byte", ns / ( iterations * text.size() ) },
+			   { "MB/s", iterations * text.size() * 1e3 / ns },
+			   { "ns/event", ns / events },
+			   { "allocs/event", (double)allocations / events } } );
+}
+
+//////////////////////////////////////////////////////////
+// Corpus - the shape of a generated config.txt.  The same Corpus
+// always gives the same file (mt19937's sequence is fixed by the
+// standard, and only its raw output is used).
+// mSections - [filter] lines, spread evenly through the mLines.
+// mDepth - filters stacked up before an [all] clears them.
+// mGpios, mSerials - how many distinct gpio and cpuserial filters
+// the headers are drawn from.
+struct Corpus
+{
+  size_t mLines;
+  size_t mSections;
+  size_t mDepth;
+  size_t mGpios;
+  size_t mSerials;
+  uint32_t mSeed;
+  Corpus()
+    : mLines( 50000 )
+    , mSections( 1000 )
+    , mDepth( 2 )
+    , mGpios( 8 )
+    , mSerials( 4 )
+    , mSeed( 1 )
+  {}
+};
+
+static std::string makeConfig( const Corpus & corpus )
+{
+  static const char * platforms[] = { "pi0", "pi0w", "pi1", "pi2", "pi3",
+				      "pi3+", "pi4" };
+  std::mt19937 rng( corpus.mSeed );
+  std::vector< std::string > serials;
+  for( size_t i = 0; i < corpus.mSerials; i++ ){
+    char serial[ 16 ];
+    snprintf( serial, sizeof( serial ), "0x%08x", (unsigned)rng() );
+    serials.push_back( serial );
+  }
+  size_t every = corpus.mSections ?
+    std::max< size_t >( corpus.mLines / corpus.mSections, 1 ) : 0;
+  size_t sections = 0;
+  std::string text;
+  for( size_t i = 0; i < corpus.mLines; i++ ){
+    if( every && i % every == 0 && sections < corpus.mSections ){
+      if( sections++ % ( corpus.mDepth + 1 ) == corpus.mDepth ){
+	text += "[all]";
+      } else {
+	switch( rng() % 4 ){
+	case 0:
+	  text += std::string( "[" ) + platforms[ rng() % 7 ] + "]";
+	  break;
+	case 1:
+	  if( corpus.mGpios ){
+	    text += "[gpio" + std::to_string( rng() % corpus.mGpios ) + "=" +
+	      std::to_string( rng() % 2 ) + "]";
+	    break;
+	  }
+	  // fall through
+	case 2:
+	  if( serials.size() ){
+	    text += "[" + serials[ rng() % serials.size() ] + "]";
+	    break;
+	  }
+	  // fall through
+	default:
+	  text += "[HDMI:" + std::to_string( rng() % 2 ) + "]";
+	  break;
+	}
+      }
+    } else if( rng() % 16 == 0 ){
+      // repeated lines, as overlays are.
+      text += "dtoverlay=overlay_" + std::to_string( rng() % 32 );
+    } else {
+      text += "dtparam=option_" + std::to_string( i ) + "=on";
+    }
+    text += '\n';
+  }
+  return text;
+}
+
+static struct option bench_options[] =
+  {
+   { "lines",      required_argument, nullptr, 0 },
+   { "sections",   required_argument, nullptr, 0 },
+   { "depth",      required_argument, nullptr, 0 },
+   { "gpios",      required_argument, nullptr, 0 },
+   { "serials",    required_argument, nullptr, 0 },
+   { "seed",       required_argument, nullptr, 0 },
+   { "iterations", required_argument, nullptr, 0 },
+   { "json",       no_argument,       nullptr, 0 },
+   { nullptr,      0,                 nullptr, 0 },
+  };
+
+int main( int argc, char * argv[] )
+{
+  Corpus corpus;
+  size_t iterations = 20;
+  bool bJson = false;
+  while( true ){
+    int opt_idx = 0;
+    int c = getopt_long( argc, argv, "", bench_options, &opt_idx );
+    if( c == -1 ) break;
+    if( c == '?' ) return 1;
+    std::string option = bench_options[ opt_idx ].name;
+    size_t value = optarg ? strtoul( optarg, nullptr, 10 ) : 0;
+    if( option == "lines" ){
+      corpus.mLines = value;
+    } else if( option == "sections" ){
+      corpus.mSections = value;
+    } else if( option == "depth" ){
+      corpus.mDepth = value;
+    } else if( option == "gpios" ){
+      corpus.mGpios = value;
+    } else if( option == "serials" ){
+      corpus.mSerials = value;
+    } else if( option == "seed" ){
+      corpus.mSeed = value;
+    } else if( option == "iterations" ){
+      iterations = std::max< size_t >( value, 1 );
+    } else if( option == "json" ){
+      bJson = true;
+    }
+  }
+  if( optind < argc ){
+    corpus.mLines = strtoul( argv[ optind ], nullptr, 10 );
+  }
+  if( bJson ){
+    gResults.tableTo( stderr );
+  }
+  size_t lines = std::max< size_t >( corpus.mLines, 50 );
+  ConfigSetup cfg = buildConfig( defaultSchema );
+  if( cfg.isValid() == false ){
+    fprintf( stderr, "Invalid schema - %s\n", cfg.error().c_str() );
+    return 1;
+  }
+  char fileName[] = "/tmp/config_edit_benchXXXXXX";
+  int fd = mkstemp( fileName );
+  if( fd < 0 ){
+    perror( "mkstemp" );
+    return 1;
+  }
+  std::string configText = makeConfig( corpus );
+  {
+    std::ofstream out( fileName );
+    out << configText;
+  }
+  close( fd );
+  gResults.group( "config", "config of " + std::to_string( corpus.mLines ) +
+		  " lines, " + std::to_string( corpus.mSections ) + " sections" );
+  {
+    Measure m;
+    for( size_t i = 0; i < iterations; i++ ){
+      std::ifstream in( fileName );
+      WholeFile theFile = readWholeFile( in, cfg );
+    }
+    m.report( "readWholeFile(istream)", iterations );
+  }
+  {
+    size_t selections = 0;
+    Measure m;
+    for( size_t i = 0; i < iterations; i++ ){
+      WholeFile theFile;
+      readWholeFile( fileName, cfg, theFile );
+      selections = theFile.mSelections.size();
+    }
+    m.report( "readWholeFile(mmap)", iterations,
+	      { { "selections", double( selections ) } } );
+  }
+  {
+    // every [filter] line of the corpus, through one Section.
+    std::vector< std::string_view > headers;
+    std::string_view rest( configText );
+    while( rest.size() ){
+      size_t eol = rest.find( '\n' );
+      std::string_view line = rest.substr( 0, eol );
+      if( line.size() && line[0] == '[' ){
+	headers.push_back( line );
+      }
+      rest.remove_prefix( eol == std::string_view::npos ? rest.size() : eol + 1 );
+    }
+    size_t changes = 0;
+    Measure m;
+    for( size_t i = 0; i < iterations; i++ ){
+      WholeFile file;
+      Section section;
+      for( auto it = headers.begin(); it != headers.end(); it++ ){
+	changes += section.sectionChange( *it, cfg, file );
+      }
+    }
+    m.report( "Section::sectionChange", iterations,
+	      { { "calls/iter", double( headers.size() ) },
+		{ "changes/iter", double( changes ) / iterations } } );
+  }
+  {
+    // the filter keys alone, as sectionChange looks them up.
+    std::vector< std::string > keys;
+    std::string_view rest( configText );
+    while( rest.size() ){
+      size_t eol = rest.find( '\n' );
+      std::string key, value;
+      if( Filter::parseFilter( rest.substr( 0, eol ), key, value ) ){
+	keys.push_back( key );
+      }
+      rest.remove_prefix( eol == std::string_view::npos ? rest.size() : eol + 1 );
+    }
+    size_t found = 0;
+    Measure m;
+    for( size_t i = 0; i < iterations; i++ ){
+      for( auto it = keys.begin(); it != keys.end(); it++ ){
+	found += cfg.findValue( std::string_view( *it ) ) != nullptr;
+      }
+    }
+    m.report( "ConfigSetup::findValue", iterations,
+	      { { "calls/iter", double( keys.size() ) },
+		{ "found/iter", double( found ) / iterations } } );
+  }
+  {
+    // each section against the selections an edit typically asks for.
+    WholeFile theFile;
+    readWholeFile( fileName, cfg, theFile );
+    std::vector< std::vector< Filter > > wanted = {
+      {}, { Filter( "all", "super" ) }, { Filter( "pi4", "platform" ) },
+      { Filter( "pi4", "platform" ), Filter( "gpio1=1", "gpio" ) },
+      { Filter( "pi3+", "platform" ), Filter( "HDMI:1", "hdmi" ) } };
+    std::vector< FilterSet > required( wanted.size() );
+    for( size_t r = 0; r < wanted.size(); r++ ){
+      required[r].compile( wanted[r], theFile.mFilters );
+    }
+    size_t matched = 0;
+    Measure m;
+    for( size_t i = 0; i < iterations; i++ ){
+      for( auto r = required.begin(); r != required.end(); r++ ){
+	for( auto s = theFile.mSections.begin(); s != theFile.mSections.end();
+	     s++ ){
+	  matched += s->matches( *r );
+	}
+      }
+    }
+    m.report( "Section::matches", iterations,
+	      { { "calls/iter",
+		  double( required.size() * theFile.mSections.size() ) },
+		{ "matched/iter", double( matched ) / iterations } } );
+  }
+  {
+    WholeFile theFile;
+    readWholeFile( fileName, cfg, theFile );
+    int nullFd = open( "/dev/null", O_WRONLY );
+    size_t writeCalls = 0;
+    {
+      Measure m;
+      for( size_t i = 0; i < iterations; i++ ){
+	CountingBuf buf( nullFd );
+	std::ostream out( &buf );
+	doDisplayConfig( theFile, out, true );
+	out.flush();
+	writeCalls += buf.mWriteCalls;
+      }
+      m.report( "doDisplayConfig(ostream)", iterations,
+		{ { "write calls", double( writeCalls ) / iterations } } );
+    }
+    writeCalls = 0;
+    {
+      Measure m;
+      for( size_t i = 0; i < iterations; i++ ){
+	GatherWriter out( nullFd );
+	doDisplayConfig( theFile, out, true );
+	writeCalls += out.writeCalls();
+      }
+      m.report( "doDisplayConfig(writev)", iterations,
+		{ { "writev calls", double( writeCalls ) / iterations } } );
+    }
+    {
+      Measure m;
+      for( size_t i = 0; i < iterations; i++ ){
+	GatherWriter out( nullFd );
+	appendConfigJson( theFile, out );
+	out.flush();
+      }
+      m.report( "appendConfigJson", iterations );
+    }
+    close( nullFd );
+  }
+  {
+    // hundreds of comments and removes against one large section.
+    std::string text;
+    for( size_t i = 0; i < lines; i++ ){
+      text += "dtparam=option_" + std::to_string( i ) + "=on\n";
+    }
+    std::ofstream( fileName ) << text;
+    Actions actions;
+    for( size_t i = 0; i < 500; i++ ){
+      actions.removeCommands.push_back( "dtparam=option_" +
+					std::to_string( i * 7 % lines ) + "=on" );
+      actions.commentCommands.push_back( "dtparam=option_" +
+					 std::to_string( i * 13 % lines ) + "=on" );
+    }
+    WholeFile theFile;
+    Measure m;
+    for( size_t i = 0; i < iterations; i++ ){
+      readWholeFile( fileName, cfg, theFile );
+      applyActions( theFile, cfg, actions );
+    }
+    m.report( "read+applyActions(1000 cmds)", iterations );
+  }
+  {
+    // interleaved removes, adds and comments against one large
+    // section, as a std::vector of lines and as a WholeFile's line
+    // table.  Each iteration starts from a copy of the same lines.
+    // This compares lookup as well as storage - the vector finds a
+    // line by scanning, the line table by its hash index (which the
+    // vector can't keep, as an erase moves every later line).
+    std::vector< std::string > base;
+    std::string text;
+    for( size_t i = 0; i < lines; i++ ){
+      base.push_back( "dtparam=option_" + std::to_string( i ) + "=on" );
+      text += base.back() + "\n";
+    }
+    std::ofstream( fileName ) << text;
+    std::vector< std::pair< char, std::string > > edits;
+    for( size_t i = 0; i < 1000; i++ ){
+      std::string line = "dtparam=option_" + std::to_string( i * 7 % lines ) + "=on";
+      edits.push_back( std::make_pair( 'r', line ) );
+      edits.push_back( std::make_pair( 'a', i % 2 ? line : "added_" + std::to_string( i ) ) );
+      if( i % 4 == 0 ){
+	edits.push_back( std::make_pair( 'c', "dtparam=option_" +
+					 std::to_string( i * 13 % lines ) + "=on" ) );
+      }
+    }
+    {
+      Measure m;
+      for( size_t i = 0; i < iterations; i++ ){
+	std::vector< std::string > section = base;
+	for( auto edit = edits.begin(); edit != edits.end(); edit++ ){
+	  if( edit->first == 'a' ){
+	    section.push_back( edit->second );
+	    continue;
+	  }
+	  for( auto line = section.begin(); line != section.end(); line++ ){
+	    if( *line != edit->second ) continue;
+	    if( edit->first == 'r' ){
+	      section.erase( line );
+	      break;
+	    }
+	    *line = "#" + *line;
+	  }
+	}
+      }
+      m.report( "section edits(vector+scan)", iterations,
+		{ { "edits/iter", double( edits.size() ) } } );
+    }
+    {
+      WholeFile original;
+      readWholeFile( fileName, cfg, original );
+      Measure m;
+      for( size_t i = 0; i < iterations; i++ ){
+	WholeFile theFile = original;
+	Section & section = theFile.mSections.back();
+	for( auto edit = edits.begin(); edit != edits.end(); edit++ ){
+	  if( edit->first == 'a' ){
+	    theFile.addLine( section, edit->second );
+	  } else if( edit->first == 'r' ){
+	    theFile.removeLine( section, edit->second );
+	  } else {
+	    theFile.commentLine( section, edit->second );
+	  }
+	}
+	theFile.compact();
+      }
+      m.report( "section edits(table+index)", iterations,
+		{ { "edits/iter", double( edits.size() ) } } );
+    }
+  }
+  {
+    // a one line edit, added then removed, patched in place vs
+    // rewritten.
+    std::ofstream( fileName ) << configText;
+    Actions edits[2];
+    for( int i = 0; i < 2; i++ ){
+      edits[i].requiredFilters.push_back( Filter( "all", "super" ) );
+    }
+    edits[0].addCommands.push_back( "dtoverlay=bench" );
+    edits[1].removeCommands.push_back( "dtoverlay=bench" );
+    for( int keep = 0; keep < 2; keep++ ){
+      WriteStats stats;
+      size_t written = 0;
+      std::string error;
+      Measure m;
+      for( size_t i = 0; i < iterations; i++ ){
+	editConfig( cfg, fileName, edits[ i % 2 ], keep, error, &stats );
+	written += stats.mBytesWritten;
+      }
+      m.report( keep ? "editConfig(rewrite)" : "editConfig(patch)",
+		iterations,
+		{ { "bytes written", double( written ) / iterations },
+		  { "file size", double( stats.mFileSize ) } } );
+    }
+    unlink( ( std::string( fileName ) + ".bak" ).c_str() );
+  }
+  {
+    // an add and a remove for each platform, as an editConfig per
+    // platform vs one editConfig of all the groups (--then).
+    std::ofstream( fileName ) << configText;
+    const char * platforms[] = { "pi0", "pi1", "pi2", "pi3", "pi4" };
+    std::vector< Actions > groups[2];
+    for( int g = 0; g < 2; g++ ){
+      for( auto platform : platforms ){
+	Actions actions;
+	actions.requiredFilters.push_back( Filter( platform, "platform" ) );
+	std::string line = std::string( "dtoverlay=bench_" ) + platform;
+	if( g == 0 ){
+	  actions.addCommands.push_back( line );
+	} else {
+	  actions.removeCommands.push_back( line );
+	}
+	groups[g].push_back( actions );
+      }
+    }
+    std::string error;
+    {
+      Measure m;
+      for( size_t i = 0; i < iterations; i++ ){
+	const std::vector< Actions > & edit = groups[ i % 2 ];
+	for( auto actions = edit.begin(); actions != edit.end(); actions++ ){
+	  editConfig( cfg, fileName, *actions, false, error );
+	}
+      }
+      m.report( "editConfig(per group)", iterations,
+		{ { "groups", double( groups[0].size() ) } } );
+    }
+    {
+      Measure m;
+      for( size_t i = 0; i < iterations; i++ ){
+	editConfig( cfg, fileName, groups[ i % 2 ], false, error );
+      }
+      m.report( "editConfig(grouped)", iterations,
+		{ { "groups", double( groups[0].size() ) } } );
+    }
+  }
+  {
+    std::string text = makeSchema( lines / 50 );
+    gResults.group( "schema", "json of " + std::to_string( text.size() ) +
+		    " bytes" );
+    benchJson< json_lite::Reader, json_lite::StringInputStream >
+      ( "Reader(StringInputStream)", text, iterations );
+    benchJson< json_lite::Reader, json_lite::BufferInputStream >
+      ( "Reader(BufferInputStream)", text, iterations );
+    auto available = json_lite::scan::availableKernels();
+    for( auto kernels = available.begin(); kernels != available.end();
+	 kernels++ ){
+      std::string name = std::string( "BufferReader(" ) + (*kernels)->mName + ")";
+      benchJson< json_lite::BufferReader, json_lite::BufferInputStream >
+	( name.c_str(), text, iterations, *kernels );
+    }
+    benchPush( "PushParser(64K chunks)", text, 65536, iterations );
+    benchPush( "PushParser(16 byte chunks)", text, 16, iterations );
+    benchWriter( "BufferReader -> Writer", text, iterations );
+    {
+      Measure m;
+      size_t blocks = 0;
+      for( size_t i = 0; i < iterations; i++ ){
+	json_lite::Document document;
+	document.parse( text );
+	blocks += document.arena().blocks();
+      }
+      m.report( "Document::parse", iterations,
+		{ { "arena blocks", double( blocks ) / iterations } } );
+    }
+    {
+      Measure m;
+      for( size_t i = 0; i < iterations; i++ ){
+	ConfigSetup setup = buildConfig( defaultSchema );
+      }
+      m.report( "buildConfig(default)", iterations );
+    }
+    {
+      Measure m;
+      for( size_t i = 0; i < iterations; i++ ){
+	ConfigSetup setup = defaultConfig();
+      }
+      m.report( "defaultConfig()", iterations );
+    }
+    {
+      // a large --config, parsed vs from its compiled cache.
+      std::string schemaFile = std::string( fileName ) + ".json";
+      std::string schemaText = "{";
+      for( size_t i = 0; i < lines / 50; i++ ){
+	schemaText += i ? ",\n" : "\n";
+	schemaText += "  \"class_" + std::to_string( i ) + "\" : [ ";
+	for( size_t v = 0; v < 8; v++ ){
+	  schemaText += "\"value_" + std::to_string( i * 8 + v ) + "_\", ";
+	}
+	schemaText += "\"param_" + std::to_string( i ) + "_%d\" ]";
+      }
+      schemaText += "\n}";
+      std::ofstream( schemaFile ) << schemaText;
+      std::string error;
+      {
+	Measure m;
+	for( size_t i = 0; i < iterations; i++ ){
+	  ConfigSetup setup = buildConfig( schemaText.c_str() );
+	}
+	m.report( "buildConfig(--config)", iterations );
+      }
+      {
+	ConfigSetup setup;
+	if( loadConfig( schemaFile, setup, error ) == false ){
+	  fprintf( stderr, "%s\n", error.c_str() );
+	  unlink( schemaFile.c_str() );
+	  unlink( fileName );
+	  return 1;
+	}
+      }
+      // the same load, with the cache gone each time and written again.
+      std::string cacheFile = schemaFile + ".cache";
+      for( int parsed = 1; parsed >= 0; parsed-- ){
+	size_t hits = 0;
+	Measure m;
+	for( size_t i = 0; i < iterations; i++ ){
+	  if( parsed ) unlink( cacheFile.c_str() );
+	  ConfigSetup setup;
+	  bool fromCache = false;
+	  loadConfig( schemaFile, setup, error, &fromCache );
+	  hits += fromCache;
+	}
+	m.report( parsed ? "loadConfig(parsed)" : "loadConfig(cached)",
+		  iterations, { { "cache hits", double( hits ) / iterations } } );
+      }
+      unlink( schemaFile.c_str() );
+      unlink( cacheFile.c_str() );
+    }
+    std::string dense = makeSchema( lines / 50, true );
+    gResults.group( "dense", "dense json of " +
+		    std::to_string( dense.size() ) + " bytes" );
+    benchJson< json_lite::Reader, json_lite::StringInputStream >
+      ( "Reader(StringInputStream)", dense, iterations );
+    benchJson< json_lite::BufferReader, json_lite::BufferInputStream >
+      ( "BufferReader", dense, iterations );
+    std::string numbers = makeNumbers( lines / 50 );
+    gResults.group( "numeric", "numeric json of " +
+		    std::to_string( numbers.size() ) + " bytes" );
+    benchJson< json_lite::Reader, json_lite::StringInputStream >
+      ( "Reader(StringInputStream)", numbers, iterations );
+    benchJson< json_lite::BufferReader, json_lite::BufferInputStream >
+      ( "BufferReader", numbers, iterations );
+  }
+  {
+    // round trips to a server holding the parsed file.
+    std::string socketPath = std::string( fileName ) + ".sock";
+    ConfigServer server( cfg );
+    std::string error;
+    if( server.open( socketPath, error ) ){
+      std::thread serving( [&server]() { server.run(); } );
+      int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+      struct sockaddr_un addr;
+      memset( &addr, 0, sizeof( addr ) );
+      addr.sun_family = AF_UNIX;
+      strcpy( addr.sun_path, socketPath.c_str() );
+      if( connect( fd, (struct sockaddr *)&addr, sizeof( addr ) ) == 0 ){
+	std::string request = std::string( "[\"config_edit\", \"--remove\", "
+					   "\"no_such_line\", \"-f\", \"" ) +
+	  fileName + "\"]\n";
+	size_t requests = 1000;
+	std::string reply;
+	Measure m;
+	for( size_t i = 0; i < requests; i++ ){
+	  if( write( fd, request.data(), request.size() ) < 0 ) break;
+	  char buf[ 256 ];
+	  reply.clear();
+	  while( reply.find( '\n' ) == std::string::npos ){
+	    ssize_t got = read( fd, buf, sizeof( buf ) );
+	    if( got <= 0 ) break;
+	    reply.append( buf, got );
+	  }
+	}
+	m.report( "server request (edit)", requests,
+		  { { "cache hits", double( server.cache().mHits ) },
+		    { "reloads", double( server.cache().mReloads ) } } );
+      }
+      close( fd );
+      server.stop();
+      serving.join();
+    }
+  }
+  {
+    // exec to exit of config_edit (from beside bench) printing a
+    // small file - dominated by process startup.
+    std::string program = argv[0];
+    size_t slash = program.rfind( '/' );
+    program = ( slash == std::string::npos ? std::string( "." ) :
+		program.substr( 0, slash ) ) + "/config_edit";
+    std::string small = std::string( fileName ) + ".small";
+    std::ofstream( small ) << "[pi4]\ndtoverlay=vc4-kms-v3d\n[all]\n";
+    if( access( program.c_str(), X_OK ) == 0 ){
+      gResults.group( "startup", "startup of " + program );
+      const char * args[] = { program.c_str(), "--print", "-f", small.c_str(),
+			      nullptr };
+      posix_spawn_file_actions_t actions;
+      posix_spawn_file_actions_init( &actions );
+      posix_spawn_file_actions_addopen( &actions, STDOUT_FILENO, "/dev/null",
+					O_WRONLY, 0 );
+      size_t runs = 200;
+      Measure m;
+      for( size_t i = 0; i < runs; i++ ){
+	pid_t pid;
+	int status;
+	if( posix_spawn( &pid, program.c_str(), &actions, nullptr,
+			 const_cast< char ** >( args ), environ ) != 0 ){
+	  break;
+	}
+	waitpid( pid, &status, 0 );
+      }
+      m.report( "config_edit --print", runs );
+      posix_spawn_file_actions_destroy( &actions );
+    }
+    unlink( small.c_str() );
+  }
+  unlink( fileName );
+  if( bJson ){
+    std::string out;
+    json_lite::Writer writer( out );
+    writer.StartObject();
+    writer.Key( "corpus" );
+    writer.StartObject();
+    writer.Key( "lines" );
+    writer.Uint64( corpus.mLines );
+    writer.Key( "sections" );
+    writer.Uint64( corpus.mSections );
+    writer.Key( "depth" );
+    writer.Uint64( corpus.mDepth );
+    writer.Key( "gpios" );
+    writer.Uint64( corpus.mGpios );
+    writer.Key( "serials" );
+    writer.Uint64( corpus.mSerials );
+    writer.Key( "seed" );
+    writer.Uint( corpus.mSeed );
+    writer.Key( "bytes" );
+    writer.Uint64( configText.size() );
+    writer.EndObject();
+    writer.Key( "iterations" );
+    writer.Uint64( iterations );
+    writer.Key( "results" );
+    gResults.writeJson( writer );
+    writer.EndObject();
+    printf( "%s\n", out.c_str() );
+  }
+  return 0;
+}
@@ -0,0 +1,422 @@
+//////////////////////////////////////////////////////////
+// config_check - behaviour checks of the config_edit library.
+//
+//  ./config_check
+//
+//  Each check prints a line when it fails.  Exits 1 if any did.
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "config_edit.h"
+#include "options.h"
+
+static size_t gChecks = 0;
+static size_t gFailures = 0;
+
+static bool expect( bool ok, const std::string & what )
+{
+  gChecks++;
+  if( ok == false ){
+    gFailures++;
+    printf( "failed: %s\n", what.c_str() );
+  }
+  return ok;
+}
+
+static bool expectText( const std::string & got, const std::string & expected,
+			const std::string & what )
+{
+  if( expect( got == expected, what ) == false ){
+    printf( "expected:\n%s\ngot:\n%s\n", expected.c_str(), got.c_str() );
+    return false;
+  }
+  return true;
+}
+
+static void writeFile( const std::string & fileName,
+		       const std::string & contents )
+{
+  std::ofstream out( fileName, std::ios::binary | std::ios::trunc );
+  out << contents;
+}
+
+static std::string readFile( const std::string & fileName )
+{
+  std::ifstream in( fileName, std::ios::binary );
+  std::ostringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
+
+static bool exists( const std::string & fileName )
+{
+  return access( fileName.c_str(), F_OK ) == 0;
+}
+
+// text after the edit given by args, as the command line would
+// make it.
+static std::string edit( const ConfigSetup & cfg, const std::string & text,
+			 const std::vector< std::string > & args )
+{
+  std::vector< std::string > argv( 1, "config_edit" );
+  argv.insert( argv.end(), args.begin(), args.end() );
+  Options options;
+  if( parseOptions( argv, options ) == false ){
+    return "(invalid options)";
+  }
+  std::istringstream input( text );
+  WholeFile theFile = readWholeFile( input, cfg );
+  applyActions( theFile, cfg, options.groups );
+  std::ostringstream out;
+  doDisplayConfig( theFile, out, false );
+  return out.str();
+}
+
+//////////////////////////////////////////////////////////
+// --then
+static void checkGroups( const ConfigSetup & cfg )
+{
+  static const char * text =
+    "# hi\n"
+    "dtparam=audio=on\n"
+    "[pi4]\n"
+    "dtoverlay=vc4\n"
+    "[gpio4=1]\n"
+    "gp=1\n"
+    "[all]\n"
+    "foo=1\n";
+  // groups with the same filters, matching nothing, share the new
+  // sections.
+  expectText( edit( cfg, text, { "--platform", "pi0", "--add", "a=1",
+				 "--then", "--platform", "pi0", "--add", "b=2" } ),
+	      std::string( text ) + "[pi0]\na=1\nb=2\n",
+	      "--then groups with the same new filters" );
+  expectText( edit( cfg, text, { "--platform", "pi0", "--add", "a=1",
+				 "--then", "--platform", "pi4", "--add", "c=3",
+				 "--then", "--platform", "pi0", "--add", "b=2" } ),
+	      "# hi\ndtparam=audio=on\n[pi4]\ndtoverlay=vc4\nc=3\n"
+	      "[gpio4=1]\ngp=1\n[all]\nfoo=1\n[pi0]\na=1\nb=2\n",
+	      "--then groups with the same new filters, apart" );
+  // otherwise a group is as the same edit run on its own, after
+  // the groups before it.
+  std::vector< std::vector< std::string > > steps = {
+    { "--platform", "pi4", "--comment", "dtoverlay=vc4", "--add", "x=1" },
+    { "--platform", "pi3", "--add", "y=1" },
+    { "--remove", "foo=1", "--add", "z=1" },
+    { "--platform", "pi4", "--gpio", "gpio4=1", "--remove", "gp=1" },
+  };
+  std::string sequential = text;
+  std::vector< std::string > grouped;
+  for( size_t i = 0; i < steps.size(); i++ ){
+    sequential = edit( cfg, sequential, steps[i] );
+    if( i ) grouped.push_back( "--then" );
+    grouped.insert( grouped.end(), steps[i].begin(), steps[i].end() );
+  }
+  expectText( edit( cfg, text, grouped ), sequential,
+	      "--then groups as separate edits" );
+  // a trailing --then starts no group.
+  grouped.push_back( "--then" );
+  expectText( edit( cfg, text, grouped ), sequential, "a trailing --then" );
+}
+
+//////////////////////////////////////////////////////////
+// KeyMatcher - findValue against patternMatches tried on each
+// value in turn, the longest base winning, then the later value.
+class KeyGenerator
+{
+  std::mt19937_64 mRandom;
+  size_t below( size_t n )
+  {
+    return mRandom() % n;
+  }
+  void digits( std::string & key, size_t count, bool hex )
+  {
+    static const char chars[] = "0123456789abcdefABCDEF";
+    for( size_t i = 0; i < count; i++ ){
+      key += chars[ below( hex ? 22 : 10 ) ];
+    }
+  }
+public:
+  KeyGenerator()
+    : mRandom( 7 )
+  {}
+  // a key pattern might match - mostly one it does.
+  std::string matching( const std::string & pattern )
+  {
+    std::string key;
+    for( size_t pos = 0; pos < pattern.size(); pos++ ){
+      if( pattern[ pos ] != '%' ){
+	key += pattern[ pos ];
+	continue;
+      }
+      char ch = pattern[ ++pos ];
+      if( ch == '{' || ch == '(' ){
+	size_t close = pattern.find( ch == '{' ? '}' : ')', pos );
+	std::string text = pattern.substr( pos + 1, close - pos - 1 );
+	pos = close;
+	if( ch == '{' ){
+	  size_t dash = text.find( '-' );
+	  uint64_t low = std::stoull( text.substr( 0, dash ) );
+	  uint64_t high = std::stoull( text.substr( dash + 1 ) );
+	  // sometimes just outside the range, or with a leading 0.
+	  uint64_t value = low + below( high - low + 1 );
+	  if( below( 8 ) == 0 ) value = below( 2 ) || low == 0 ? high + 1 : low - 1;
+	  if( below( 8 ) == 0 ) key += '0';
+	  key += std::to_string( value );
+	} else {
+	  std::vector< std::string > choices( 1 );
+	  for( char c : text ){
+	    if( c == '|' ) choices.emplace_back();
+	    else choices.back() += c;
+	  }
+	  key += choices[ below( choices.size() ) ];
+	}
+      } else if( ch == '%' ){
+	key += '%';
+      } else {
+	size_t width = 0;
+	while( pattern[ pos ] >= '0' && pattern[ pos ] <= '9' ){
+	  width = width * 10 + pattern[ pos++ ] - '0';
+	}
+	if( width == 0 || below( 8 ) == 0 ) width = below( 4 );
+	digits( key, width, pattern[ pos ] == 'x' );
+      }
+    }
+    return key;
+  }
+  // key with a byte removed, added or changed.
+  std::string changed( std::string key )
+  {
+    static const char chars[] = "0123456789aAfgxz%:=-|()+";
+    size_t pos = below( key.size() + 1 );
+    switch( below( 3 ) ){
+    case 0:
+      if( pos < key.size() ) key.erase( pos, 1 );
+      break;
+    case 1:
+      key.insert( pos, 1, chars[ below( sizeof( chars ) - 1 ) ] );
+      break;
+    default:
+      if( pos < key.size() ) key[ pos ] = chars[ below( sizeof( chars ) - 1 ) ];
+    }
+    return key;
+  }
+  const std::string & pick( const std::vector< std::string > & from )
+  {
+    return from[ below( from.size() ) ];
+  }
+};
+
+// values - the schema's values, in order.
+static void checkMatcher( const ConfigSetup & cfg,
+			  const std::vector< ConfigValue > & values,
+			  const std::string & name )
+{
+  std::vector< std::string > patterns;
+  for( const ConfigValue & value : values ){
+    patterns.push_back( value.mPattern );
+  }
+  KeyGenerator generator;
+  size_t mismatches = 0;
+  const size_t keys = 20000;
+  for( size_t k = 0; k < keys; k++ ){
+    std::string key = generator.matching( generator.pick( patterns ) );
+    for( size_t c = k % 3; c; c-- ){
+      key = generator.changed( key );
+    }
+    const ConfigValue * expected = nullptr;
+    for( const ConfigValue & value : values ){
+      if( patternMatches( value.mPattern, key ) &&
+	  ( expected == nullptr ||
+	    value.mDesc.base().length() >= expected->mDesc.base().length() ) ){
+	expected = &value;
+      }
+    }
+    const ConfigValue * found = cfg.findValue( std::string_view( key ) );
+    bool same = found == nullptr || expected == nullptr ? found == expected :
+      found->mClass == expected->mClass && found->mPattern == expected->mPattern;
+    if( same == false && mismatches++ < 10 ){
+      auto text = []( const ConfigValue * value ) {
+	return value ? value->mClass + " " + value->mPattern : "nothing";
+      };
+      printf( "%s: '%s' found %s, expected %s\n", name.c_str(), key.c_str(),
+	      text( found ).c_str(), text( expected ).c_str() );
+    }
+  }
+  expect( mismatches == 0, "KeyMatcher and patternMatches agree on " +
+	  std::to_string( keys ) + " keys of " + name );
+}
+
+// a schema loaded by loadConfig - from the json, then from the cache
+// made of it, or from the json again once the cache is out of date.
+static void checkCache( const std::string & json,
+			const std::vector< ConfigValue > & values,
+			const std::string & dir )
+{
+  const std::string schemaFile = dir + "/schema.json";
+  const std::string cacheFile = schemaFile + ".cache";
+  writeFile( schemaFile, json );
+  unlink( cacheFile.c_str() );
+  const char * loads[] = { "parsed", "cached", "stale", "truncated" };
+  for( size_t i = 0; i < sizeof( loads ) / sizeof( loads[0] ); i++ ){
+    std::string what = std::string( "loadConfig " ) + loads[i];
+    if( i == 2 ){
+      writeFile( schemaFile, json + " " );
+    } else if( i == 3 ){
+      std::string cache = readFile( cacheFile );
+      writeFile( cacheFile, cache.substr( 0, cache.size() - 1 ) );
+    }
+    ConfigSetup setup;
+    std::string error;
+    bool fromCache = false;
+    if( expect( loadConfig( schemaFile, setup, error, &fromCache ),
+		what + " " + error ) ){
+      expect( fromCache == ( i == 1 ), what + " from the cache" );
+      checkMatcher( setup, values, what );
+    }
+  }
+  unlink( schemaFile.c_str() );
+  unlink( cacheFile.c_str() );
+}
+
+static void checkMatchers( const ConfigSetup & cfg, const std::string & dir )
+{
+  std::vector< ConfigValue > values;
+  for( size_t i = 0; i < schema::defaultTable.mCount; i++ ){
+    const SchemaEntry & entry = schema::defaultTable.mEntries[i];
+    if( entry.mValue.data() == nullptr ) continue;
+    values.emplace_back( entry.mValue );
+    values.back().mClass = std::string( entry.mClass );
+  }
+  checkMatcher( cfg, values, "the default schema" );
+
+  // patterns which overlap, share prefixes and split a run of digits
+  // more than one way.
+  std::vector< std::pair< std::string, std::vector< std::string > > > classes = {
+    { "a", { "gpio%d", "gpio%{0-27}", "gpio4", "%x", "0x%8x", "0x%x" } },
+    { "b", { "cm%(4|5|45)%d", "cm4", "pi%(0|0w|02)", "%%%d", "%d%d",
+	     "%2d-%{7-120}", "hdmi:%{0-1}", "a%dx%d" } },
+    { "c", {} },
+    { "d", { "gpio4", "%(x|y)%3x", "%{0-0}" } },
+  };
+  std::string json = "{";
+  values.clear();
+  for( size_t c = 0; c < classes.size(); c++ ){
+    json += ( c ? ", \"" : "\"" ) + classes[c].first + "\": [";
+    for( size_t v = 0; v < classes[c].second.size(); v++ ){
+      json += ( v ? ", \"" : "\"" ) + classes[c].second[v] + "\"";
+      values.emplace_back( classes[c].second[v] );
+      values.back().mClass = classes[c].first;
+    }
+    json += "]";
+  }
+  json += "}";
+  ConfigSetup custom = buildConfig( json.c_str() );
+  if( expect( custom.isValid(), "the custom schema compiles " +
+	      custom.error() ) ){
+    checkMatcher( custom, values, "a custom schema" );
+  }
+  checkCache( json, values, dir );
+}
+
+//////////////////////////////////////////////////////////
+// patches and their journals
+// a journal as patchConfig writes it, putting back original at
+// offset of a file which was size bytes long.
+static std::string journal( size_t size, size_t offset,
+			    const std::string & original )
+{
+  uint64_t header[4] = { size, offset, original.size(),
+			 contentHash( original ) };
+  std::string text( "cejrnl01" );
+  text.append( (const char *)header, sizeof( header ) );
+  return text + original;
+}
+
+static void checkJournal( const ConfigSetup & cfg, const std::string & dir )
+{
+  const std::string text =
+    "dtparam=audio=on\n"
+    "[pi4]\n"
+    "dtoverlay=vc4\n"
+    "[all]\n"
+    "foo=1\n";
+  const std::string fileName = dir + "/config.txt";
+  const std::string journalName = fileName + ".journal";
+  std::vector< std::string > args = { "--platform", "pi4", "--add", "x=1" };
+  Options options;
+  std::vector< std::string > argv( 1, "config_edit" );
+  argv.insert( argv.end(), args.begin(), args.end() );
+  if( expect( parseOptions( argv, options ), "journal edit options" ) == false ){
+    return;
+  }
+  std::string edited = edit( cfg, text, args );
+
+  // a patch which finishes leaves no journal.
+  writeFile( fileName, text );
+  std::string error;
+  WriteStats stats;
+  expect( editConfig( cfg, fileName, options.groups, false, error, &stats ),
+	  "patch " + error );
+  expect( stats.mPatched, "the edit is a patch" );
+  expectText( readFile( fileName ), edited, "the patched file" );
+  expect( exists( journalName ) == false, "no journal after a patch" );
+
+  // one cut short after its journal is rolled back, by the next read.
+  size_t offset = edited.find( "x=1" );
+  std::string torn = text.substr( 0, offset ) + "x=1\n[al";
+  writeFile( fileName, torn );
+  writeFile( journalName, journal( text.size(), offset,
+				   text.substr( offset ) ) );
+  WholeFile theFile;
+  expect( readWholeFile( fileName, cfg, theFile ), "read a torn patch" );
+  expectText( readFile( fileName ), text, "a torn patch rolled back" );
+  expect( exists( journalName ) == false, "no journal after recovery" );
+  std::ostringstream out;
+  doDisplayConfig( theFile, out, false );
+  expectText( out.str(), text, "the recovered file as read" );
+
+  // a journal which doesn't check out was never finished, so the file
+  // wasn't touched.
+  std::string complete = journal( text.size(), 0, "dtparam" );
+  std::string changed = complete;
+  changed.back() ^= 1;
+  std::vector< std::string > broken = {
+    complete.substr( 0, complete.size() - 1 ),	// cut short
+    changed,					// not the bytes hashed
+    complete.substr( 0, 12 ),			// cut short in the header
+    "cejrnl00" + complete.substr( 8 ),		// not a journal
+  };
+  for( size_t i = 0; i < broken.size(); i++ ){
+    std::string what = "unfinished journal " + std::to_string( i );
+    writeFile( fileName, edited );
+    writeFile( journalName, broken[i] );
+    expect( recoverConfig( fileName, error ), what + " " + error );
+    expectText( readFile( fileName ), edited, what + " is ignored" );
+    expect( exists( journalName ) == false, what + " is removed" );
+  }
+  unlink( fileName.c_str() );
+  unlink( journalName.c_str() );
+}
+
+int main()
+{
+  ConfigSetup cfg = defaultConfig();
+  if( expect( cfg.isValid(), "the default schema compiles" ) ){
+    checkGroups( cfg );
+    char dir[] = "/tmp/config_check.XXXXXX";
+    if( expect( mkdtemp( dir ) != nullptr, "make a directory" ) ){
+      checkMatchers( cfg, dir );
+      checkJournal( cfg, dir );
+      rmdir( dir );
+    }
+  }
+  printf( "config_check: %zu checks, %zu failed\n", gChecks, gFailures );
+  return gFailures ? 1 : 0;
+}
@@ -0,0 +1,2172 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "config_edit.h"
+#include "work_pool.h"
+
+MappedFile::~MappedFile()
+{
+  if( mMapped ){
+    munmap( const_cast<char *>( mData ), mSize );
+  }
+}
+
+//////////////////////////////////////////////////////////
+// 8 bytes a step - each word xored in, then multiplied and the high
+// half folded down, so every byte reaches every bit.  A byte at a
+// time (FNV-1a) was a multiply per byte, and showed up in hashing a
+// large --config.
+uint64_t contentHash( std::string_view contents )
+{
+  const uint64_t multiplier = 0x9e3779b97f4a7c15ULL;
+  uint64_t hash = 0xcbf29ce484222325ULL ^ contents.size();
+  const char * data = contents.data();
+  size_t words = contents.size() / sizeof( uint64_t );
+  for( size_t i = 0; i < words; i++ ){
+    uint64_t word;
+    memcpy( &word, data + i * sizeof( word ), sizeof( word ) );
+    hash = ( hash ^ word ) * multiplier;
+    hash ^= hash >> 32;
+  }
+  uint64_t tail = 0;
+  memcpy( &tail, data + words * sizeof( tail ),
+	  contents.size() - words * sizeof( tail ) );
+  hash = ( hash ^ tail ) * multiplier;
+  return hash ^ ( hash >> 29 );
+}
+
+bool MappedFile::open( const std::string & fileName )
+{
+  int fd = ::open( fileName.c_str(), O_RDONLY | O_CLOEXEC );
+  if( fd < 0 ){
+    return false;
+  }
+  struct stat st;
+  if( fstat( fd, &st ) != 0 ){
+    close( fd );
+    return false;
+  }
+  mStatus = st;
+  if( S_ISREG( st.st_mode ) && st.st_size > 0 ){
+    void * addr = mmap( nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if( addr != MAP_FAILED ){
+      close( fd );
+      mData = static_cast<const char *>( addr );
+      mSize = st.st_size;
+      mMapped = true;
+      return true;
+    }
+  }
+  // not mappable - read it into mBuffer.
+  char block[ 65536 ];
+  ssize_t got;
+  while( ( got = read( fd, block, sizeof( block ) ) ) != 0 ){
+    if( got < 0 ){
+      if( errno == EINTR ) continue;
+      close( fd );
+      return false;
+    }
+    mBuffer.append( block, got );
+  }
+  close( fd );
+  mData = mBuffer.data();
+  mSize = mBuffer.size();
+  return true;
+}
+
+void GatherWriter::append( std::string_view text )
+{
+  if( text.size() == 0 ) return;
+  if( mPieces.size() ){
+    Piece & last = mPieces.back();
+    if( last.mBase && last.mBase + last.mLength == text.data() ){
+      last.mLength += text.size();
+      mPending += text.size();
+      return;
+    }
+  }
+  mPieces.push_back( Piece{ text.data(), 0, text.size() } );
+  mPending += text.size();
+}
+
+void GatherWriter::appendCopy( std::string_view text )
+{
+  if( text.size() == 0 ) return;
+  size_t offset = mScratch.size();
+  mScratch.append( text.data(), text.size() );
+  mPending += text.size();
+  if( mPieces.size() ){
+    Piece & last = mPieces.back();
+    if( last.mBase == nullptr && last.mOffset + last.mLength == offset ){
+      last.mLength += text.size();
+      return;
+    }
+  }
+  mPieces.push_back( Piece{ nullptr, offset, text.size() } );
+}
+
+void GatherWriter::prependCopy( std::string_view text )
+{
+  if( text.size() == 0 ) return;
+  size_t offset = mScratch.size();
+  mScratch.append( text.data(), text.size() );
+  mPending += text.size();
+  mPieces.insert( mPieces.begin(), Piece{ nullptr, offset, text.size() } );
+}
+
+//////////////////////////////////////////////////////////
+// how many bytes of the pending output are the same as the start
+// (or end) of original.
+size_t GatherWriter::commonPrefix( std::string_view original ) const
+{
+  size_t offset = 0;
+  for( auto piece = mPieces.begin(); piece != mPieces.end(); piece++ ){
+    const char * base = piece->mBase ? piece->mBase
+      : mScratch.data() + piece->mOffset;
+    size_t length = std::min( piece->mLength, original.size() - offset );
+    const char * at = original.data() + offset;
+    if( memcmp( base, at, length ) != 0 ){
+      return offset + ( std::mismatch( base, base + length, at ).first - base );
+    }
+    offset += length;
+    if( length < piece->mLength ) break;
+  }
+  return offset;
+}
+size_t GatherWriter::commonSuffix( std::string_view original,
+				   size_t limit ) const
+{
+  size_t matched = 0;
+  for( auto piece = mPieces.rbegin(); piece != mPieces.rend(); piece++ ){
+    const char * base = piece->mBase ? piece->mBase
+      : mScratch.data() + piece->mOffset;
+    size_t length = std::min( piece->mLength,
+			      std::min( original.size(), limit ) - matched );
+    for( size_t i = 1; i <= length; i++ ){
+      if( base[ piece->mLength - i ] !=
+	  original[ original.size() - matched - i ] ){
+	return matched + i - 1;
+      }
+    }
+    matched += length;
+    if( length < piece->mLength ) break;
+  }
+  return matched;
+}
+std::string GatherWriter::copyRange( size_t from, size_t to ) const
+{
+  std::string text;
+  text.reserve( to - from );
+  size_t offset = 0;
+  for( auto piece = mPieces.begin(); piece != mPieces.end() && offset < to;
+       piece++ ){
+    size_t pieceEnd = offset + piece->mLength;
+    if( pieceEnd > from ){
+      const char * base = piece->mBase ? piece->mBase
+	: mScratch.data() + piece->mOffset;
+      size_t first = from > offset ? from - offset : 0;
+      size_t last = std::min( pieceEnd, to ) - offset;
+      text.append( base + first, last - first );
+    }
+    offset = pieceEnd;
+  }
+  return text;
+}
+
+//////////////////////////////////////////////////////////
+// write the pieces IOV_MAX at a time, restarting after
+// short writes.
+bool GatherWriter::flush()
+{
+  std::vector< struct iovec > iov;
+  iov.reserve( std::min( mPieces.size(), (size_t)IOV_MAX ) );
+  size_t next = 0;
+  while( mFailed == false && next < mPieces.size() ){
+    iov.clear();
+    for( ; next < mPieces.size() && iov.size() < IOV_MAX; next++ ){
+      const Piece & piece = mPieces[ next ];
+      const char * base = piece.mBase ? piece.mBase
+	: mScratch.data() + piece.mOffset;
+      iov.push_back( iovec{ const_cast<char *>( base ), piece.mLength } );
+    }
+    size_t first = 0;
+    while( first < iov.size() ){
+      ssize_t done = writev( mFd, &iov[ first ], iov.size() - first );
+      mWriteCalls++;
+      if( done < 0 ){
+	if( errno == EINTR ) continue;
+	mFailed = true;
+	break;
+      }
+      mBytesWritten += done;
+      while( first < iov.size() && (size_t)done >= iov[ first ].iov_len ){
+	done -= iov[ first ].iov_len;
+	first++;
+      }
+      if( done ){
+	iov[ first ].iov_base = static_cast<char *>( iov[ first ].iov_base ) + done;
+	iov[ first ].iov_len -= done;
+      }
+    }
+  }
+  mPieces.clear();
+  mScratch.clear();
+  mPending = 0;
+  return !mFailed;
+}
+
+// root as a table, the views being into root.
+static bool schemaEntries( const json_lite::Value & root,
+			   std::vector< SchemaEntry > & entries,
+			   const char * & error )
+{
+  if( root.isObject() == false ){
+    error = "Expected an object of filter classes";
+    return false;
+  }
+  for( size_t i = 0; i < root.size(); i++ ){
+    const json_lite::Member & member = root.member( i );
+    if( member.mValue.isArray() == false ){
+      error = "Expected an array of filter values";
+      return false;
+    }
+    if( member.mValue.size() == 0 ){
+      entries.push_back( SchemaEntry{ member.mKey, std::string_view() } );
+    }
+    for( size_t v = 0; v < member.mValue.size(); v++ ){
+      const json_lite::Value & value = member.mValue[ v ];
+      if( value.isString() == false ){
+	error = "Expected a string filter value";
+	return false;
+      }
+      entries.push_back( SchemaEntry{ member.mKey, value.asString() } );
+    }
+  }
+  return true;
+}
+
+bool ConfigSetup::load( const json_lite::Value & root )
+{
+  std::vector< SchemaEntry > entries;
+  const char * error = nullptr;
+  if( schemaEntries( root, entries, error ) == false ){
+    setError( error );
+    return false;
+  }
+  return load( entries.data(), entries.size() );
+}
+
+std::vector< ConfigValue > ConfigSetup::loadValues( const SchemaEntry * entries,
+						    size_t count )
+{
+  std::vector< ConfigValue > values;
+  values.reserve( count );
+  for( size_t i = 0; i < count; ){
+    std::string_view className = entries[i].mClass;
+    size_t last = i;
+    while( last < count && entries[ last ].mClass == className ) last++;
+    ConfigClass nextClass( className.data(), className.size() );
+    nextClass.mValues.reserve( last - i );
+    for( ; i < last; i++ ){
+      if( entries[i].mValue.data() == nullptr ) continue;
+      ConfigValue newValue( entries[i].mValue );
+      newValue.mClass = nextClass.className();
+      mAllConfigs.insert_or_assign( newValue.mDesc.base(), newValue );
+      values.push_back( newValue );
+      nextClass.mValues.push_back( std::move( newValue ) );
+    }
+    std::string name = nextClass.className();
+    mConfigs.insert_or_assign( std::move( name ), std::move( nextClass ) );
+  }
+  return values;
+}
+
+bool ConfigSetup::load( const SchemaEntry * entries, size_t count )
+{
+  std::vector< ConfigValue > values = loadValues( entries, count );
+  std::string error;
+  if( mMatcher.build( values, error ) == false ){
+    setError( error.c_str() );
+    return false;
+  }
+  return true;
+}
+
+bool ConfigSetup::load( const SchemaEntry * entries, size_t count,
+			const KeyMatcher::Tables & tables )
+{
+  if( mMatcher.load( loadValues( entries, count ), tables ) == false ){
+    setError( "Compiled filter values don't fit the schema" );
+    return false;
+  }
+  return true;
+}
+
+//////////////////////////////////////////////////////////
+// one % item of a pattern.
+// mWidth - psDigits, psHex: the exact number of digits, or 0 for any.
+// mText - psLiteral: the character, psChoice: the alternatives a|b|c
+struct PatternSpec
+{
+  enum Kind { psLiteral, psDigits, psHex, psRange, psChoice };
+  Kind mKind;
+  size_t mWidth;
+  uint64_t mLow;
+  uint64_t mHigh;
+  std::string_view mText;
+};
+static const uint64_t maxRange = 100000;
+
+static bool parseNumber( std::string_view text, uint64_t & value )
+{
+  auto result = std::from_chars( text.data(), text.data() + text.size(), value );
+  return text.size() && result.ec == std::errc() &&
+    result.ptr == text.data() + text.size();
+}
+
+// the item starting at pattern[0] ( a '%' ), which takes length
+// characters of the pattern.
+static bool patternSpec( std::string_view pattern, PatternSpec & spec,
+			 size_t & length )
+{
+  if( pattern.size() < 2 ) return false;
+  spec.mWidth = 0;
+  char ch = pattern[1];
+  if( ch == '%' ){
+    spec.mKind = PatternSpec::psLiteral;
+    spec.mText = pattern.substr( 1, 1 );
+    length = 2;
+    return true;
+  }
+  if( ch == '{' || ch == '(' ){
+    size_t close = pattern.find( ch == '{' ? '}' : ')' );
+    if( close == std::string_view::npos ) return false;
+    spec.mText = pattern.substr( 2, close - 2 );
+    length = close + 1;
+    if( ch == '(' ){
+      spec.mKind = PatternSpec::psChoice;
+      return true;
+    }
+    spec.mKind = PatternSpec::psRange;
+    size_t dash = spec.mText.find( '-' );
+    return dash != std::string_view::npos &&
+      parseNumber( spec.mText.substr( 0, dash ), spec.mLow ) &&
+      parseNumber( spec.mText.substr( dash + 1 ), spec.mHigh ) &&
+      spec.mLow <= spec.mHigh && spec.mHigh - spec.mLow < maxRange;
+  }
+  size_t pos = 1;
+  while( pos < pattern.size() && pattern[ pos ] >= '0' && pattern[ pos ] <= '9' &&
+	 spec.mWidth < 64 ){
+    spec.mWidth = spec.mWidth * 10 + ( pattern[ pos++ ] - '0' );
+  }
+  if( pos == pattern.size() || spec.mWidth >= 64 ) return false;
+  if( pattern[ pos ] == 'd' ){
+    spec.mKind = PatternSpec::psDigits;
+  } else if( pattern[ pos ] == 'x' ){
+    spec.mKind = PatternSpec::psHex;
+  } else {
+    return false;
+  }
+  length = pos + 1;
+  return true;
+}
+
+static bool isDigit( char ch, bool hex )
+{
+  return ( ch >= '0' && ch <= '9' ) ||
+    ( hex && ( ( ch >= 'a' && ch <= 'f' ) || ( ch >= 'A' && ch <= 'F' ) ) );
+}
+
+bool patternValid( std::string_view pattern )
+{
+  size_t pos = 0;
+  while( ( pos = pattern.find( '%', pos ) ) != std::string_view::npos ){
+    PatternSpec spec;
+    size_t length;
+    if( patternSpec( pattern.substr( pos ), spec, length ) == false ){
+      return false;
+    }
+    pos += length;
+  }
+  return true;
+}
+
+// by backtracking - for one value, findValue uses the KeyMatcher.
+bool patternMatches( std::string_view pattern, std::string_view key )
+{
+  while( pattern.size() && pattern[0] != '%' ){
+    if( key.size() == 0 || key[0] != pattern[0] ) return false;
+    pattern.remove_prefix( 1 );
+    key.remove_prefix( 1 );
+  }
+  if( pattern.size() == 0 ){
+    return key.size() == 0;
+  }
+  PatternSpec spec;
+  size_t length;
+  if( patternSpec( pattern, spec, length ) == false ){
+    return false;
+  }
+  std::string_view rest = pattern.substr( length );
+  size_t run = 0;
+  switch( spec.mKind ){
+  case PatternSpec::psLiteral:
+    return key.size() && key[0] == '%' &&
+      patternMatches( rest, key.substr( 1 ) );
+  case PatternSpec::psDigits:
+  case PatternSpec::psHex:
+    while( run < key.size() &&
+	   isDigit( key[ run ], spec.mKind == PatternSpec::psHex ) ){
+      run++;
+    }
+    if( spec.mWidth ){
+      return run >= spec.mWidth &&
+	patternMatches( rest, key.substr( spec.mWidth ) );
+    }
+    for( size_t n = 0; n <= run; n++ ){
+      if( patternMatches( rest, key.substr( n ) ) ) return true;
+    }
+    return false;
+  case PatternSpec::psRange:
+    while( run < key.size() && run < 19 && isDigit( key[ run ], false ) ){
+      run++;
+    }
+    // no leading zeros.
+    for( size_t n = 1; n <= run && ( n == 1 || key[0] != '0' ); n++ ){
+      uint64_t value;
+      parseNumber( key.substr( 0, n ), value );
+      if( value >= spec.mLow && value <= spec.mHigh &&
+	  patternMatches( rest, key.substr( n ) ) ){
+	return true;
+      }
+    }
+    return false;
+  case PatternSpec::psChoice:
+    {
+      std::string_view choices = spec.mText;
+      while( true ){
+	size_t bar = choices.find( '|' );
+	std::string_view choice = choices.substr( 0, bar );
+	if( key.substr( 0, choice.size() ) == choice &&
+	    patternMatches( rest, key.substr( choice.size() ) ) ){
+	  return true;
+	}
+	if( bar == std::string_view::npos ) return false;
+	choices.remove_prefix( bar + 1 );
+      }
+    }
+  }
+  return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Nfa - the patterns as a Thompson automaton, made
+// deterministic by KeyMatcher::build.
+// Literal text is shared as a trie (mLiteral), so patterns with a
+// common prefix don't all become live at the start of every key.
+// That is safe as a literal state is only entered by its one edge,
+// so every pattern through it has read the same text.
+struct Nfa
+{
+  static const uint32_t epsilon = ~0u;
+  struct Edge {
+    uint32_t mFrom;
+    uint32_t mLabel;   // index into mLabels, or epsilon
+    uint32_t mTo;
+  };
+  std::vector< std::string > mLabels;   // the bytes each label moves on
+  std::vector< Edge > mEdges;           // by mFrom, once finished
+  std::vector< uint32_t > mFirst;       // [ state ] first edge, once finished
+  std::vector< int32_t > mAccept;
+  std::unordered_map< uint64_t, uint32_t > mLiteral;  // state << 8 | byte
+  uint32_t mByteLabel[ 256 ];
+  uint32_t mDigitLabel[ 2 ];
+  Nfa()
+  {
+    std::fill( mByteLabel, mByteLabel + 256, epsilon );
+    mDigitLabel[0] = mDigitLabel[1] = epsilon;
+  }
+  uint32_t state()
+  {
+    mAccept.push_back( -1 );
+    return mAccept.size() - 1;
+  }
+  void edge( uint32_t from, uint32_t label, uint32_t to )
+  {
+    mEdges.push_back( Edge{ from, label, to } );
+  }
+  uint32_t label( uint32_t & cached, const std::string & bytes )
+  {
+    if( cached == epsilon ){
+      cached = mLabels.size();
+      mLabels.push_back( bytes );
+    }
+    return cached;
+  }
+  uint32_t digitLabel( bool hex );
+  uint32_t literal( uint32_t from, std::string_view text )
+  {
+    for( size_t i = 0; i < text.size(); i++ ){
+      unsigned char ch = text[i];
+      auto inserted = mLiteral.insert( std::make_pair( uint64_t( from ) << 8 | ch, 0 ) );
+      if( inserted.second ){
+	inserted.first->second = state();
+	edge( from, label( mByteLabel[ ch ], std::string( 1, ch ) ),
+	      inserted.first->second );
+      }
+      from = inserted.first->second;
+    }
+    return from;
+  }
+  // the state after pattern, from current.
+  uint32_t add( uint32_t current, std::string_view pattern );
+  // group the edges by state.
+  void finish();
+  // states and those reachable from them by epsilon, sorted and
+  // without duplicates.
+  // mark is scratch, a flag per state.
+  void closure( std::vector< uint32_t > & states,
+		std::vector< bool > & mark ) const;
+};
+
+uint32_t Nfa::digitLabel( bool hex )
+{
+  std::string bytes;
+  if( mDigitLabel[ hex ] == epsilon ){
+    for( int ch = 0; ch < 256; ch++ ){
+      if( isDigit( ch, hex ) ) bytes += char( ch );
+    }
+  }
+  return label( mDigitLabel[ hex ], bytes );
+}
+
+uint32_t Nfa::add( uint32_t current, std::string_view pattern )
+{
+  while( pattern.size() ){
+    size_t pos = pattern.find( '%' );
+    current = literal( current, pattern.substr( 0, pos ) );
+    if( pos == std::string_view::npos ) break;
+    PatternSpec spec;
+    size_t length;
+    patternSpec( pattern.substr( pos ), spec, length );
+    pattern.remove_prefix( pos + length );
+    switch( spec.mKind ){
+    case PatternSpec::psLiteral:
+      current = literal( current, spec.mText );
+      break;
+    case PatternSpec::psDigits:
+    case PatternSpec::psHex:
+      {
+	uint32_t digits = digitLabel( spec.mKind == PatternSpec::psHex );
+	if( spec.mWidth == 0 ){
+	  uint32_t loop = state();
+	  edge( current, epsilon, loop );
+	  edge( loop, digits, loop );
+	  current = loop;
+	}
+	for( size_t i = 0; i < spec.mWidth; i++ ){
+	  uint32_t to = state();
+	  edge( current, digits, to );
+	  current = to;
+	}
+      }
+      break;
+    case PatternSpec::psRange:
+      {
+	// each number, sharing their prefixes.
+	uint32_t end = state();
+	char text[ 24 ];
+	for( uint64_t value = spec.mLow; value <= spec.mHigh; value++ ){
+	  auto result = std::to_chars( text, text + sizeof( text ), value );
+	  edge( literal( current, std::string_view( text, result.ptr - text ) ),
+		epsilon, end );
+	}
+	current = end;
+      }
+      break;
+    case PatternSpec::psChoice:
+      {
+	uint32_t end = state();
+	std::string_view choices = spec.mText;
+	while( true ){
+	  size_t bar = choices.find( '|' );
+	  edge( literal( current, choices.substr( 0, bar ) ), epsilon, end );
+	  if( bar == std::string_view::npos ) break;
+	  choices.remove_prefix( bar + 1 );
+	}
+	current = end;
+      }
+      break;
+    }
+  }
+  return current;
+}
+
+void Nfa::finish()
+{
+  mFirst.assign( mAccept.size() + 1, 0 );
+  for( auto it = mEdges.begin(); it != mEdges.end(); it++ ){
+    mFirst[ it->mFrom + 1 ]++;
+  }
+  for( size_t s = 0; s < mAccept.size(); s++ ){
+    mFirst[ s + 1 ] += mFirst[ s ];
+  }
+  std::vector< Edge > sorted( mEdges.size() );
+  std::vector< uint32_t > next( mFirst.begin(), mFirst.end() - 1 );
+  for( auto it = mEdges.begin(); it != mEdges.end(); it++ ){
+    sorted[ next[ it->mFrom ]++ ] = *it;
+  }
+  mEdges.swap( sorted );
+}
+
+void Nfa::closure( std::vector< uint32_t > & states,
+		   std::vector< bool > & mark ) const
+{
+  size_t distinct = 0;
+  for( size_t i = 0; i < states.size(); i++ ){
+    if( mark[ states[i] ] == false ){
+      mark[ states[i] ] = true;
+      states[ distinct++ ] = states[i];
+    }
+  }
+  states.resize( distinct );
+  for( size_t i = 0; i < states.size(); i++ ){
+    for( uint32_t e = mFirst[ states[i] ]; e != mFirst[ states[i] + 1 ]; e++ ){
+      const Edge & edge = mEdges[ e ];
+      if( edge.mLabel == epsilon && mark[ edge.mTo ] == false ){
+	mark[ edge.mTo ] = true;
+	states.push_back( edge.mTo );
+      }
+    }
+  }
+  for( auto it = states.begin(); it != states.end(); it++ ){
+    mark[ *it ] = false;
+  }
+  std::sort( states.begin(), states.end() );
+}
+
+// a set of nfa states, for the ids of the dfa states.
+struct StateSetHash
+{
+  size_t operator()( const std::vector< uint32_t > & states ) const
+  {
+    return contentHash( std::string_view( (const char *)states.data(),
+					  states.size() * sizeof( uint32_t ) ) );
+  }
+};
+
+//////////////////////////////////////////////////////////
+// subset construction over the byte classes - the bytes with the
+// same membership of every move label.
+bool KeyMatcher::build( const std::vector< ConfigValue > & values,
+			std::string & error )
+{
+  static const size_t maxStates = 1 << 16;
+  mValues = values;
+  auto better = [this]( int32_t a, int32_t b ) {
+    if( b < 0 ) return true;
+    size_t lengthA = mValues[a].mDesc.base().length();
+    size_t lengthB = mValues[b].mDesc.base().length();
+    return lengthA != lengthB ? lengthA > lengthB : a > b;
+  };
+  Nfa nfa;
+  uint32_t start = nfa.state();
+  for( size_t v = 0; v < mValues.size(); v++ ){
+    const std::string & pattern = mValues[v].mPattern;
+    if( patternValid( pattern ) == false ){
+      error = "Invalid filter value pattern '" + pattern + "'";
+      return false;
+    }
+    uint32_t last = nfa.add( start, pattern );
+    if( better( v, nfa.mAccept[ last ] ) ){
+      nfa.mAccept[ last ] = v;
+    }
+  }
+  nfa.finish();
+
+  // split the classes by each label in turn, then number them by
+  // their first byte.
+  uint32_t byteClass[ 256 ] = {};
+  uint32_t classes = 1;
+  std::vector< int32_t > split;
+  for( auto label = nfa.mLabels.begin(); label != nfa.mLabels.end(); label++ ){
+    split.assign( classes, -1 );
+    for( auto ch = label->begin(); ch != label->end(); ch++ ){
+      uint32_t & cls = byteClass[ (unsigned char)*ch ];
+      if( split[ cls ] < 0 ){
+	split[ cls ] = classes++;
+      }
+      cls = split[ cls ];
+    }
+  }
+  split.assign( classes, -1 );
+  mClasses = 0;
+  for( int ch = 0; ch < 256; ch++ ){
+    if( split[ byteClass[ ch ] ] < 0 ){
+      split[ byteClass[ ch ] ] = mClasses++;
+    }
+    mByteClass[ ch ] = split[ byteClass[ ch ] ];
+  }
+  std::vector< std::vector< uint8_t > > labelClasses( nfa.mLabels.size() );
+  for( size_t label = 0; label < nfa.mLabels.size(); label++ ){
+    std::vector< uint8_t > & classes = labelClasses[ label ];
+    for( auto ch = nfa.mLabels[ label ].begin(); ch != nfa.mLabels[ label ].end(); ch++ ){
+      uint8_t cls = mByteClass[ (unsigned char)*ch ];
+      if( std::find( classes.begin(), classes.end(), cls ) == classes.end() ){
+	classes.push_back( cls );
+      }
+    }
+  }
+
+  // each dfa state is a sorted set of nfa states, the key of ids.
+  // Most are a single literal state, which are found in single.
+  std::unordered_map< std::vector< uint32_t >, uint32_t, StateSetHash > ids;
+  std::vector< uint32_t > single( nfa.mAccept.size(), 0 );
+  std::vector< std::vector< uint32_t > > dfa( 2 );
+  std::vector< bool > mark( nfa.mAccept.size() );
+  auto id = [&]( const std::vector< uint32_t > & states ) -> uint32_t & {
+    return states.size() == 1 ? single[ states[0] ] : ids[ states ];
+  };
+  dfa[1].push_back( start );
+  nfa.closure( dfa[1], mark );
+  id( dfa[1] ) = 1;
+  mNext.assign( 2 * mClasses, 0 );
+  mAccept.assign( 2, -1 );
+  std::vector< std::vector< uint32_t > > next( mClasses );
+  std::vector< uint8_t > used;
+  for( size_t d = 1; d < dfa.size(); d++ ){
+    used.clear();
+    for( auto it = dfa[d].begin(); it != dfa[d].end(); it++ ){
+      int32_t accept = nfa.mAccept[ *it ];
+      if( accept >= 0 && better( accept, mAccept[d] ) ){
+	mAccept[d] = accept;
+      }
+      for( uint32_t e = nfa.mFirst[ *it ]; e != nfa.mFirst[ *it + 1 ]; e++ ){
+	const Nfa::Edge & edge = nfa.mEdges[ e ];
+	if( edge.mLabel == Nfa::epsilon ) continue;
+	const std::vector< uint8_t > & classes = labelClasses[ edge.mLabel ];
+	for( auto c = classes.begin(); c != classes.end(); c++ ){
+	  if( next[ *c ].empty() ){
+	    used.push_back( *c );
+	  }
+	  next[ *c ].push_back( edge.mTo );
+	}
+      }
+    }
+    // classes nothing moves on stay at state 0.
+    for( auto c = used.begin(); c != used.end(); c++ ){
+      std::vector< uint32_t > & states = next[ *c ];
+      nfa.closure( states, mark );
+      uint32_t & to = id( states );
+      if( to == 0 ){
+	if( dfa.size() == maxStates ){
+	  error = "Filter value patterns too complex";
+	  return false;
+	}
+	to = dfa.size();
+	dfa.push_back( states );
+	mNext.resize( dfa.size() * mClasses, 0 );
+	mAccept.push_back( -1 );
+      }
+      mNext[ d * mClasses + *c ] = to;
+      states.clear();
+    }
+  }
+  return true;
+}
+
+bool KeyMatcher::load( std::vector< ConfigValue > values,
+		       const Tables & tables )
+{
+  // every move and accept in range, so find needs no checks.
+  if( tables.mClasses == 0 || tables.mClasses > 256 || tables.mStates < 2 ){
+    return false;
+  }
+  for( int ch = 0; ch < 256; ch++ ){
+    if( tables.mByteClass[ ch ] >= tables.mClasses ) return false;
+  }
+  size_t moves = size_t( tables.mStates ) * tables.mClasses;
+  for( size_t i = 0; i < moves; i++ ){
+    if( tables.mNext[i] >= tables.mStates ) return false;
+  }
+  for( uint32_t state = 0; state < tables.mStates; state++ ){
+    if( tables.mAccept[ state ] < -1 ||
+	tables.mAccept[ state ] >= (int64_t)values.size() ){
+      return false;
+    }
+  }
+  mValues = std::move( values );
+  std::copy( tables.mByteClass, tables.mByteClass + 256, mByteClass );
+  mClasses = tables.mClasses;
+  mNext.assign( tables.mNext, tables.mNext + moves );
+  mAccept.assign( tables.mAccept, tables.mAccept + tables.mStates );
+  return true;
+}
+
+ConfigSetup buildConfig( const char * config )
+{
+  ConfigSetup newConfig;
+  json_lite::Document document;
+  if( document.parse( config ) == false ){
+    newConfig.setError( document.error().c_str() );
+    return newConfig;
+  }
+  // a rejected value pattern leaves newConfig invalid, with the error.
+  newConfig.load( document.root() );
+  return newConfig;
+
+}
+
+ConfigSetup defaultConfig()
+{
+  ConfigSetup newConfig;
+  newConfig.load( schema::defaultTable.mEntries, schema::defaultTable.mCount );
+  return newConfig;
+}
+
+//////////////////////////////////////////////////////////
+// schema cache - a SchemaEntry table with its strings interned,
+// and the KeyMatcher compiled from it
+//   SchemaCacheHeader
+//   SchemaCacheRecord[ mEntries ]
+//   uint8_t byte classes[ 256 ]
+//   uint32_t next[ mStates * mClasses ]
+//   int32_t accept[ mStates ]
+//   mStrings bytes of string data, which the records index
+// in native byte order (the cache is only for this machine).
+// Everything before the strings is a multiple of 4 bytes long, so
+// the tables are used where they were mapped, not copied out.
+struct SchemaCacheHeader
+{
+  char mMagic[ 8 ];
+  uint64_t mHash;          // contentHash of the json
+  uint32_t mEntries;
+  uint32_t mStrings;
+  uint32_t mClasses;
+  uint32_t mStates;
+};
+struct SchemaCacheRecord
+{
+  uint32_t mClass;
+  uint32_t mClassLength;
+  uint32_t mValue;         // noValue - a class without values
+  uint32_t mValueLength;
+};
+static const char schemaCacheMagic[ 8 ] = { 'c', 'f', 'g', 's', 'c', 'h',
+					    '\0', 2 };
+static const uint32_t noValue = ~0u;
+
+// the entries and matcher of a cache made from json with hash, as
+// views into contents.
+static bool readSchemaCache( std::string_view contents, uint64_t hash,
+			     std::vector< SchemaEntry > & entries,
+			     KeyMatcher::Tables & tables )
+{
+  SchemaCacheHeader header;
+  if( contents.size() < sizeof( header ) ) return false;
+  memcpy( &header, contents.data(), sizeof( header ) );
+  if( memcmp( header.mMagic, schemaCacheMagic, sizeof( schemaCacheMagic ) ) ||
+      header.mHash != hash || header.mClasses > 256 ||
+      contents.size() != sizeof( header ) +
+      header.mEntries * sizeof( SchemaCacheRecord ) + 256 +
+      uint64_t( header.mStates ) * header.mClasses * sizeof( uint32_t ) +
+      header.mStates * sizeof( int32_t ) + (size_t)header.mStrings ){
+    return false;
+  }
+  const char * records = contents.data() + sizeof( header );
+  const char * byteClass = records + header.mEntries * sizeof( SchemaCacheRecord );
+  const char * next = byteClass + 256;
+  const char * accept = next + size_t( header.mStates ) * header.mClasses *
+    sizeof( uint32_t );
+  const char * strings = accept + header.mStates * sizeof( int32_t );
+  tables = KeyMatcher::Tables{ (const uint8_t *)byteClass, header.mClasses,
+			       header.mStates, (const uint32_t *)next,
+			       (const int32_t *)accept };
+  auto inStrings = [&]( uint32_t offset, uint32_t length ) {
+    return offset <= header.mStrings && length <= header.mStrings - offset;
+  };
+  entries.clear();
+  entries.reserve( header.mEntries );
+  for( uint32_t i = 0; i < header.mEntries; i++ ){
+    SchemaCacheRecord record;
+    memcpy( &record, records + i * sizeof( record ), sizeof( record ) );
+    if( inStrings( record.mClass, record.mClassLength ) == false ) return false;
+    SchemaEntry entry{ std::string_view( strings + record.mClass,
+					 record.mClassLength ),
+		       std::string_view() };
+    if( record.mValue != noValue ){
+      if( inStrings( record.mValue, record.mValueLength ) == false ) return false;
+      entry.mValue = std::string_view( strings + record.mValue,
+				       record.mValueLength );
+    }
+    entries.push_back( entry );
+  }
+  return true;
+}
+
+// written to a temporary and renamed, so a reader never sees part
+// of a cache.  Failure only costs the next run a parse.
+static void writeSchemaCache( const std::string & cacheFile, uint64_t hash,
+			      const std::vector< SchemaEntry > & entries,
+			      const KeyMatcher::Tables & tables )
+{
+  std::string strings;
+  std::unordered_map< std::string_view, uint32_t > interned;
+  std::vector< SchemaCacheRecord > records;
+  auto intern = [&]( std::string_view text ) {
+    auto it = interned.find( text );
+    if( it != interned.end() ){
+      return it->second;
+    }
+    uint32_t offset = strings.size();
+    strings.append( text );
+    interned.insert( std::make_pair( text, offset ) );
+    return offset;
+  };
+  for( auto it = entries.begin(); it != entries.end(); it++ ){
+    SchemaCacheRecord record{ intern( it->mClass ),
+			      uint32_t( it->mClass.size() ), noValue, 0 };
+    if( it->mValue.data() ){
+      record.mValue = intern( it->mValue );
+      record.mValueLength = it->mValue.size();
+    }
+    records.push_back( record );
+  }
+  SchemaCacheHeader header;
+  memcpy( header.mMagic, schemaCacheMagic, sizeof( schemaCacheMagic ) );
+  header.mHash = hash;
+  header.mEntries = records.size();
+  header.mStrings = strings.size();
+  header.mClasses = tables.mClasses;
+  header.mStates = tables.mStates;
+  std::string contents( reinterpret_cast< const char * >( &header ),
+			sizeof( header ) );
+  contents.append( reinterpret_cast< const char * >( records.data() ),
+		   records.size() * sizeof( SchemaCacheRecord ) );
+  contents.append( reinterpret_cast< const char * >( tables.mByteClass ), 256 );
+  contents.append( reinterpret_cast< const char * >( tables.mNext ),
+		   size_t( tables.mStates ) * tables.mClasses * sizeof( uint32_t ) );
+  contents.append( reinterpret_cast< const char * >( tables.mAccept ),
+		   tables.mStates * sizeof( int32_t ) );
+  contents += strings;
+
+  std::string tmpFile = cacheFile + "." + std::to_string( getpid() );
+  int fd = ::open( tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		   0644 );
+  if( fd < 0 ){
+    return;
+  }
+  bool written = write( fd, contents.data(), contents.size() ) ==
+    (ssize_t)contents.size();
+  if( close( fd ) != 0 || written == false ||
+      rename( tmpFile.c_str(), cacheFile.c_str() ) != 0 ){
+    unlink( tmpFile.c_str() );
+  }
+}
+
+bool loadConfig( const std::string & jsonFile, ConfigSetup & config,
+		 std::string & error, bool * fromCache )
+{
+  MappedFile json;
+  if( json.open( jsonFile ) == false ){
+    error = "Unable to read " + jsonFile + " - " + strerror( errno );
+    return false;
+  }
+  uint64_t hash = contentHash( json.contents() );
+  std::string cacheFile = jsonFile + ".cache";
+  std::vector< SchemaEntry > entries;
+  {
+    MappedFile cache;
+    KeyMatcher::Tables tables;
+    // one which doesn't check out is rebuilt.
+    ConfigSetup cached;
+    if( cache.open( cacheFile ) &&
+	readSchemaCache( cache.contents(), hash, entries, tables ) &&
+	cached.load( entries.data(), entries.size(), tables ) ){
+      if( fromCache ) *fromCache = true;
+      config = std::move( cached );
+      return true;
+    }
+  }
+  if( fromCache ) *fromCache = false;
+  json_lite::Document document;
+  if( document.parse( json.contents() ) == false ){
+    error = jsonFile + " - " + document.error();
+    return false;
+  }
+  const char * message = nullptr;
+  if( schemaEntries( document.root(), entries, message ) == false ){
+    error = jsonFile + " - " + message;
+    return false;
+  }
+  // only a schema which compiled is cached.
+  if( config.load( entries.data(), entries.size() ) == false ){
+    error = jsonFile + " - " + config.error();
+    return false;
+  }
+  writeSchemaCache( cacheFile, hash, entries, config.matcher().tables() );
+  return true;
+}
+
+bool Section::sectionChange( std::string_view line,
+			     const ConfigSetup & config, WholeFile & file )
+{
+  std::string key, value;
+  if( Filter::parseFilter( line, key,value ) ){
+    const ConfigValue * found = config.findValue( std::string_view( key ) );
+    if( found ){
+      mSelection = file.mSelections.add( mSelection, found->mClass, key, value,
+					 line, file.mFilters );
+      return true;
+    }
+
+  }
+  return false;
+}
+
+SelectionRef SelectionPool::node( const SelectionRef & parent,
+				  const std::shared_ptr< const Filter > & flt,
+				  FilterTable & table )
+{
+  SelectionRef & found = mNodes[ std::make_pair( parent.get(), flt.get() ) ];
+  if( found ){
+    return found;
+  }
+  std::shared_ptr< Selection > made = std::make_shared< Selection >();
+  made->mFilter = flt;
+  made->mParent = parent;
+  made->mSize = parent ? parent->mSize + 1 : 1;
+  // the parent's ids, plus this filter's - the same as compiling
+  // the whole list, as a class is only active once.
+  if( parent ){
+    made->mIds = parent->mIds;
+  }
+  FilterSet & ids = made->mIds;
+  uint32_t id = table.intern( *flt );
+  ids.mIds.insert( std::lower_bound( ids.mIds.begin(), ids.mIds.end(), id ), id );
+  ids.mMask |= 1ULL << ( id % 64 );
+  ids.mExact = ids.mExact && id < 64;
+  ids.mCount = made->mSize;
+  ids.mAll = made->mSize == 1 && flt->mClass == "super" && flt->mKey == "all";
+  found = made;
+  return found;
+}
+
+SelectionRef SelectionPool::add( const SelectionRef & selection,
+				 const std::string & fltClass,
+				 const std::string & key, const std::string & value,
+				 std::string_view line, FilterTable & table )
+{
+  std::string name = fltClass;
+  name += '\0';
+  name += line;
+  std::shared_ptr< const Filter > & flt = mFilters[ name ];
+  if( !flt ){
+    flt = std::make_shared< Filter >( fltClass, key, value, std::string( line ) );
+  }
+  if( fltClass == "super" ){ // Special case.
+			     // Remove all other filters
+    return node( nullptr, flt, table );
+  }
+  // keep all filters not current - those after the one of this
+  // class are added again without it.
+  std::vector< const Selection * > later;
+  const Selection * at = selection.get();
+  while( at && at->mFilter->mClass != fltClass ){
+    later.push_back( at );
+    at = at->mParent.get();
+  }
+  if( at == nullptr ){
+    return node( selection, flt, table );
+  }
+  SelectionRef kept = at->mParent;
+  for( auto it = later.rbegin(); it != later.rend(); it++ ){
+    kept = node( kept, (*it)->mFilter, table );
+  }
+  return node( kept, flt, table );
+}
+
+uint32_t FilterTable::intern( const Filter & flt )
+{
+  std::string name = flt.mClass;
+  name += '\0';
+  name += flt.mKey;
+  name += '\0';
+  name += flt.mValue;
+  auto it = mIds.find( name );
+  if( it != mIds.end() ){
+    return it->second;
+  }
+  uint32_t id = mIds.size();
+  mIds.insert( std::make_pair( name, id ) );
+  return id;
+}
+
+void FilterSet::compile( const std::vector< Filter > & filters,
+			 FilterTable & table )
+{
+  mIds.clear();
+  mMask = 0;
+  mExact = true;
+  mCount = filters.size();
+  mAll = filters.size() == 1 && filters[0].mClass == "super" &&
+    filters[0].mKey == "all";
+  for( auto it = filters.begin(); it != filters.end(); it++ ){
+    uint32_t id = table.intern( *it );
+    mIds.push_back( id );
+    mMask |= 1ULL << ( id % 64 );
+    if( id >= 64 ){
+      mExact = false;
+    }
+  }
+  std::sort( mIds.begin(), mIds.end() );
+  mIds.erase( std::unique( mIds.begin(), mIds.end() ), mIds.end() );
+}
+
+void LineIndex::clear()
+{
+  mSlots.clear();
+  mUsed = 0;
+  mLive = 0;
+  mBuilt = false;
+}
+
+//////////////////////////////////////////////////////////
+// keep at most half the slots in use, re-inserting the live ones
+// (which also clears out deleted slots).
+void LineIndex::grow()
+{
+  std::vector< Slot > old;
+  old.swap( mSlots );
+  size_t size = 16;
+  while( size < mLive * 4 ) size *= 2;
+  mSlots.assign( size, Slot{ empty, 0 } );
+  mUsed = mLive;
+  size_t mask = size - 1;
+  for( auto it = old.begin(); it != old.end(); it++ ){
+    if( it->mPos == empty || it->mPos == deleted ) continue;
+    size_t i = it->mHash & mask;
+    while( mSlots[i].mPos != empty ) i = ( i + 1 ) & mask;
+    mSlots[i] = *it;
+  }
+}
+
+void LineIndex::build( const Line * lines, size_t count )
+{
+  clear();
+  mLive = 0;
+  for( size_t pos = 0; pos < count; pos++ ){
+    if( lines[pos].isRemoved() == false ) mLive++;
+  }
+  grow();
+  mLive = 0;
+  mUsed = 0;
+  mBuilt = true;
+  for( size_t pos = 0; pos < count; pos++ ){
+    if( lines[pos].isRemoved() == false ){
+      insert( pos, lines[pos].view() );
+    }
+  }
+}
+
+void LineIndex::insert( uint32_t pos, std::string_view text )
+{
+  if( ( mUsed + 1 ) * 2 > mSlots.size() ){
+    grow();
+  }
+  uint32_t h = hash( text );
+  size_t mask = mSlots.size() - 1;
+  size_t i = h & mask;
+  while( mSlots[i].mPos != empty && mSlots[i].mPos != deleted ){
+    i = ( i + 1 ) & mask;
+  }
+  if( mSlots[i].mPos == empty ) mUsed++;
+  mSlots[i] = Slot{ pos, h };
+  mLive++;
+}
+
+void LineIndex::erase( uint32_t pos, std::string_view text )
+{
+  if( mSlots.size() == 0 ) return;
+  uint32_t h = hash( text );
+  size_t mask = mSlots.size() - 1;
+  for( size_t i = h & mask; mSlots[i].mPos != empty; i = ( i + 1 ) & mask ){
+    if( mSlots[i].mPos == pos ){
+      mSlots[i].mPos = deleted;
+      mLive--;
+      return;
+    }
+  }
+}
+
+std::string_view TextArena::copyLine( std::string_view text )
+{
+  static const size_t blockSize = 64 * 1024;
+  if( mUsed + text.size() + 1 > mSize ){
+    mSize = std::max( blockSize, text.size() + 1 );
+    mBlocks.emplace_back( new char[ mSize ] );
+    mBytes += mSize;
+    mUsed = 0;
+  }
+  char * copy = mBlocks.back().get() + mUsed;
+  memcpy( copy, text.data(), text.size() );
+  copy[ text.size() ] = '\n';
+  mUsed += text.size() + 1;
+  return std::string_view( copy, text.size() );
+}
+
+std::string_view WholeFile::copyLine( std::string_view text )
+{
+  if( !mArena ){
+    mArena = std::make_shared< TextArena >();
+  }
+  return mArena->copyLine( text );
+}
+
+//////////////////////////////////////////////////////////
+// A section only grows in place at the end of the table, or into
+// the rows it has spare.  Otherwise its lines move to the end, with
+// as many spare rows again - so adding to a section in the middle
+// costs O(1) amortized, and the rows it leaves are dropped by
+// compact().  An empty section always starts at the end, so only
+// one section can own the end of the table.
+void WholeFile::appendLine( Section & section, const Line & line )
+{
+  size_t end = section.mFirst + section.mCapacity;
+  if( section.mCount < section.mCapacity ){
+    // a spare row, from when the section was last relocated
+  } else if( section.mCapacity && end == mLines.size() ){
+    // the last rows of the table, grow in place
+    mLines.emplace_back();
+    section.mCapacity++;
+  } else {
+    size_t first = mLines.size();
+    mLines.resize( first + std::max< size_t >( section.mCount * 2, 1 ) );
+    std::copy( mLines.begin() + section.mFirst,
+	       mLines.begin() + section.mFirst + section.mCount,
+	       mLines.begin() + first );
+    section.mFirst = first;
+    section.mCapacity = mLines.size() - first;
+  }
+  mLines[ section.mFirst + section.mCount++ ] = line;
+}
+
+void WholeFile::commentLine( Section & section, std::string_view text )
+{
+  LineRange< Line > rows = lines( section );
+  if( section.mLineIndex.built() == false ){
+    section.mLineIndex.build( rows.begin(), rows.size() );
+  }
+  std::vector< uint32_t > found;
+  section.mLineIndex.find( text, rows.begin(), [&found]( uint32_t pos ) {
+    found.push_back( pos );
+  } );
+  for( auto pos = found.begin(); pos != found.end(); pos++ ){
+    Line & line = rows.begin()[ *pos ];
+    std::string replacement = "#";
+    replacement += line.view();
+    section.mLineIndex.erase( *pos, line.view() );
+    line = Line( copyLine( replacement ), true );
+    section.mLineIndex.insert( *pos, line.view() );
+  }
+}
+
+bool WholeFile::removeLine( Section & section, std::string_view text )
+{
+  LineRange< Line > rows = lines( section );
+  if( section.mLineIndex.built() == false ){
+    section.mLineIndex.build( rows.begin(), rows.size() );
+  }
+  uint32_t first = 0xffffffff;
+  section.mLineIndex.find( text, rows.begin(), [&first]( uint32_t pos ) {
+    first = std::min( first, pos );
+  } );
+  if( first == 0xffffffff ){
+    return false;
+  }
+  section.mLineIndex.erase( first, rows.begin()[ first ].view() );
+  rows.begin()[ first ].remove();
+  section.mRemovedLines++;
+  return true;
+}
+
+void WholeFile::addLine( Section & section, const std::string & text )
+{
+  appendLine( section, Line( copyLine( text ), true ) );
+  if( section.mLineIndex.built() ){
+    section.mLineIndex.insert( section.mCount - 1,
+			       mLines[ section.mFirst + section.mCount - 1 ].view() );
+  }
+}
+
+void WholeFile::compact()
+{
+  bool moved = false;
+  size_t rows = 0;
+  for( auto section = mSections.begin(); section != mSections.end(); section++ ){
+    moved = moved || section->mFirst != rows || section->mCapacity != section->mCount;
+    rows += section->mCount - section->mRemovedLines;
+  }
+  if( moved == false && rows == mLines.size() ){
+    return;
+  }
+  std::vector< Line > table;
+  table.reserve( rows );
+  for( auto section = mSections.begin(); section != mSections.end(); section++ ){
+    size_t first = table.size();
+    LineRange< Line > old = lines( *section );
+    for( auto line = old.begin(); line != old.end(); line++ ){
+      if( line->isRemoved() == false ) table.push_back( *line );
+    }
+    section->mFirst = first;
+    section->mCount = table.size() - first;
+    section->mCapacity = section->mCount;
+    if( section->mRemovedLines ){
+      section->mRemovedLines = 0;
+      section->mLineIndex.clear();
+    }
+  }
+  mLines.swap( table );
+}
+
+void WholeFile::detachFrom( size_t offset )
+{
+  if( !mStorage ) return;
+  std::string_view contents = mStorage->contents();
+  for( auto section = mSections.begin(); section != mSections.end(); section++ ){
+    LineRange< Line > rows = lines( *section );
+    for( auto line = rows.begin(); line != rows.end(); line++ ){
+      std::string_view view = line->view();
+      if( view.data() < contents.data() ||
+	  view.data() >= contents.data() + contents.size() ){
+	continue;
+      }
+      if( (size_t)( view.data() - contents.data() ) + view.size() + 1 > offset ){
+	bool removed = line->isRemoved();
+	*line = Line( copyLine( view ), true );
+	if( removed ) line->remove();
+      }
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////
+// hash of a sorted id list - the key of WholeFile::mIndex.
+uint64_t WholeFile::signature( const uint32_t * ids, size_t count )
+{
+  uint64_t hash = 0x9e3779b97f4a7c15ULL ^ count;
+  for( size_t i = 0; i < count; i++ ){
+    hash ^= ids[i] + 0x9e3779b97f4a7c15ULL + ( hash << 6 ) + ( hash >> 2 );
+  }
+  return hash;
+}
+
+void WholeFile::appendSection( Section && section )
+{
+  size_t index = mSections.size();
+  const FilterSet & ids = section.selectionIds();
+  mIndex[ signature( ids.mIds.data(), ids.mIds.size() ) ].push_back( index );
+  if( ids.mAll ){
+    mAllSections.push_back( index );
+  }
+  mSections.push_back( std::move( section ) );
+}
+
+//////////////////////////////////////////////////////////
+// A section matches when its selection is a subset of required
+// (see Section::matches), so look up each subset of the required
+// ids.  There are only a handful of required filters, so this costs
+// the number of matches, not the size of the file.  Hash collisions
+// are removed by checking each candidate with matches().
+void WholeFile::findMatches( const FilterSet & required,
+			     std::vector< size_t > & found ) const
+{
+  static const size_t maxIndexed = 16;
+  found.clear();
+  const std::vector< uint32_t > & ids = required.mIds;
+  if( ids.size() > maxIndexed ){
+    for( size_t i = 0; i < mSections.size(); i++ ){
+      if( mSections[i].matches( required ) ){
+	found.push_back( i );
+      }
+    }
+    return;
+  }
+  auto gather = [&]( const uint32_t * subset, size_t count ) {
+    auto it = mIndex.find( signature( subset, count ) );
+    if( it != mIndex.end() ){
+      found.insert( found.end(), it->second.begin(), it->second.end() );
+    }
+  };
+  if( required.mCount == 0 ){
+    gather( nullptr, 0 );
+    found.insert( found.end(), mAllSections.begin(), mAllSections.end() );
+  } else {
+    uint32_t subset[ maxIndexed ];
+    for( uint32_t bits = 0; bits < ( 1u << ids.size() ); bits++ ){
+      size_t count = 0;
+      for( size_t i = 0; i < ids.size(); i++ ){
+	if( bits & ( 1u << i ) ){
+	  subset[ count++ ] = ids[i];
+	}
+      }
+      gather( subset, count );
+    }
+  }
+  std::sort( found.begin(), found.end() );
+  found.erase( std::unique( found.begin(), found.end() ), found.end() );
+  found.erase( std::remove_if( found.begin(), found.end(),
+			       [&]( size_t i ) {
+				 return !mSections[i].matches( required );
+			       } ), found.end() );
+}
+
+using namespace json_lite;
+
+//////////////////////////////////////////////////////////
+// A [filter] line closes currentSection, and starts the next one
+// with the same selection.  The finished lines are moved into the
+// file rather than copied, and the selection is shared.
+static void startSection( WholeFile & file, Section & currentSection,
+			  std::string_view line, const ConfigSetup & config )
+{
+  Section next;
+  next.mSelection = currentSection.mSelection;
+  file.appendSection( std::move( currentSection ) );
+  currentSection = std::move( next );
+  currentSection.sectionChange( line, config, file );
+}
+static bool isSectionLine( std::string_view line )
+{
+  return line.length() && line[0] == '[' &&
+    line.find( ']' ) != std::string_view::npos;
+}
+
+WholeFile readWholeFile( std::istream & input, const ConfigSetup & config)
+{
+  std::string line;
+  WholeFile file;
+  Section currentSection;
+  while( std::getline( input, line ) ){
+    if( isSectionLine( line ) ){
+      startSection( file, currentSection, line, config );
+    } else {
+      file.appendLine( currentSection, Line( file.copyLine( line ), true ) );
+    }
+  }
+  file.appendSection( std::move( currentSection ) );
+  return file;
+}
+
+WholeFile readWholeFile( const std::shared_ptr<MappedFile> & storage,
+			 const ConfigSetup & config )
+{
+  WholeFile file;
+  file.mStorage = storage;
+  Section currentSection;
+  std::string_view contents = storage->contents();
+  const char * pos = contents.data();
+  const char * end = pos + contents.size();
+  // same splitting as std::getline - no empty line after a final '\n'
+  while( pos < end ){
+    const char * eol = static_cast<const char *>( memchr( pos, '\n', end - pos ) );
+    const char * next = eol ? eol + 1 : end;
+    if( eol == nullptr ){
+      eol = end;
+    }
+    std::string_view line( pos, eol - pos );
+    if( isSectionLine( line ) ){
+      startSection( file, currentSection, line, config );
+    } else {
+      file.appendLine( currentSection, Line( line, next != eol ) );
+    }
+    pos = next;
+  }
+  file.appendSection( std::move( currentSection ) );
+  return file;
+}
+
+bool readWholeFile( const std::string & fileName, const ConfigSetup & config,
+		    WholeFile & theFile )
+{
+  std::string error;
+  if( recoverConfig( fileName, error ) == false ){
+    return false;
+  }
+  std::shared_ptr<MappedFile> storage = std::make_shared<MappedFile>();
+  if( storage->open( fileName ) == false ){
+    return false;
+  }
+  theFile = readWholeFile( storage, config );
+  return true;
+}
+
+bool doDisplayConfig( const WholeFile & theFile,
+		      std::ostream & out, bool bVerbose )
+{
+  for( auto sections = theFile.mSections.begin();
+       sections != theFile.mSections.end() ; sections++ ){
+    if( sections->entryFilter() ){
+      out << sections->entryFilter()->mLine << std::endl;
+    }
+
+    if( bVerbose ){
+      if( sections->mSelection ){
+	out << "##################################################"
+		  << std::endl;
+	out << "# Active filters" << std::endl;
+	sections->mSelection->forEach( [&]( const Filter & flt ) {
+	  out << "# " << flt.mClass << " "
+		    << flt.mKey << " " << flt.mValue << std::endl;
+	} );
+	out << "##################################################"
+		  << std::endl;
+      }
+    }
+    LineRange< const Line > lines = theFile.lines( *sections );
+    for( auto line = lines.begin(); line != lines.end(); line++ ){
+      if( line->isRemoved() ) continue;
+      out << *line << std::endl;
+    }
+  }
+
+  if( out.fail() ){
+    return false;
+  }
+  return true;
+}
+//////////////////////////////////////////////////////////
+// Same output as the ostream version, but gathered so the whole
+// file goes out in a handful of writev calls.
+void appendConfig( const WholeFile & theFile,
+		   GatherWriter & out, bool bVerbose )
+{
+  static const char newline[] = "\n";
+  static const char separator[] =
+    "##################################################\n";
+  for( auto sections = theFile.mSections.begin();
+       sections != theFile.mSections.end() ; sections++ ){
+    if( sections->entryFilter() ){
+      out.append( sections->entryFilter()->mLine );
+      out.append( newline );
+    }
+
+    if( bVerbose ){
+      if( sections->mSelection ){
+	out.append( separator );
+	out.appendCopy( "# Active filters\n" );
+	sections->mSelection->forEach( [&]( const Filter & flt ) {
+	  out.appendCopy( "# " );
+	  out.appendCopy( flt.mClass );
+	  out.appendCopy( " " );
+	  out.appendCopy( flt.mKey );
+	  out.appendCopy( " " );
+	  out.appendCopy( flt.mValue );
+	  out.appendCopy( "\n" );
+	} );
+	out.append( separator );
+      }
+    }
+    LineRange< const Line > lines = theFile.lines( *sections );
+    for( auto line = lines.begin(); line != lines.end(); line++ ){
+      if( line->isRemoved() ) continue;
+      std::string_view text;
+      if( line->terminated( text ) ){
+	out.append( text );
+      } else {
+	out.append( line->view() );
+	out.append( newline );
+      }
+    }
+  }
+}
+//////////////////////////////////////////////////////////
+// The same content for tools - one json object per file
+//   {"sections":[{"header":"[pi4]","filters":[{"class":"platform",
+//     "key":"pi4","value":""}],"lines":["dtoverlay=vc4"]}]}
+// header is null for a section with no entry filter (the start of
+// the file).  Removed lines are skipped.
+void appendConfigJson( const WholeFile & theFile, GatherWriter & out )
+{
+  std::string text;
+  json_lite::Writer writer( text );
+  writer.StartObject();
+  writer.Key( "sections" );
+  writer.StartArray();
+  for( auto sections = theFile.mSections.begin();
+       sections != theFile.mSections.end() ; sections++ ){
+    writer.StartObject();
+    writer.Key( "header" );
+    if( sections->entryFilter() ){
+      writer.String( sections->entryFilter()->mLine );
+    } else {
+      writer.Null();
+    }
+    writer.Key( "filters" );
+    writer.StartArray();
+    if( sections->mSelection ){
+      sections->mSelection->forEach( [&]( const Filter & flt ) {
+	writer.StartObject();
+	writer.Key( "class" );
+	writer.String( flt.mClass );
+	writer.Key( "key" );
+	writer.String( flt.mKey );
+	writer.Key( "value" );
+	writer.String( flt.mValue );
+	writer.EndObject();
+      } );
+    }
+    writer.EndArray();
+    writer.Key( "lines" );
+    writer.StartArray();
+    LineRange< const Line > lines = theFile.lines( *sections );
+    for( auto line = lines.begin(); line != lines.end(); line++ ){
+      if( line->isRemoved() ) continue;
+      writer.String( line->view() );
+    }
+    writer.EndArray();
+    writer.EndObject();
+  }
+  writer.EndArray();
+  writer.EndObject();
+  text += '\n';
+  out.appendCopy( text );
+}
+bool doDisplayConfig( const WholeFile & theFile,
+		      GatherWriter & out, bool bVerbose )
+{
+  appendConfig( theFile, out, bVerbose );
+  return out.flush();
+}
+bool doDisplayConfig( const WholeFile & theFile, int fd, bool bVerbose )
+{
+  GatherWriter out( fd );
+  return doDisplayConfig( theFile, out, bVerbose );
+}
+void displayConfig( const ConfigSetup & setup, const std::string & fileName,
+		    bool bJson )
+{
+  WholeFile theFile;
+  readWholeFile( fileName, setup, theFile );
+  std::cout.flush();
+  if( bJson ){
+    GatherWriter out( STDOUT_FILENO );
+    appendConfigJson( theFile, out );
+    out.flush();
+    return;
+  }
+  doDisplayConfig( theFile, STDOUT_FILENO, true );
+}
+
+//////////////////////////////////////////////////////////
+// the adds of actions, to the last section which matches required
+// - or to new sections at the end of the file when none do.
+static void addLines( WholeFile & theFile, const ConfigSetup & cfg,
+		      const Actions & actions,
+		      const std::vector< size_t > & matching )
+{
+  if( matching.size() ){
+    Section & lastMatch = theFile.mSections[ matching.back() ];
+    // inserts
+    for( auto cmd = actions.addCommands.begin();
+	 cmd != actions.addCommands.end(); cmd++ ){
+      theFile.addLine( lastMatch, *cmd );
+    }
+  } else {
+    theFile.resetToAll();
+    // carry on from the filters active at the end of the file, so
+    // the new sections have the selection they get when re-read.
+    Section currentSection;
+    if( theFile.mSections.size() ){
+      currentSection.mSelection = theFile.mSections.back().mSelection;
+    }
+    for( auto flt = actions.requiredFilters.begin();
+	 flt != actions.requiredFilters.end(); flt++ ){
+      currentSection.sectionChange( flt->mLine, cfg, theFile );
+      theFile.appendSection( currentSection );
+    }
+    for( auto cmd = actions.addCommands.begin();
+	 cmd != actions.addCommands.end(); cmd++ ){
+      theFile.addLine( *cmd );
+    }
+
+  }
+}
+
+//////////////////////////////////////////////////////////
+// applyActions - the comments, removes and adds of each group
+// made to the sections of theFile which match its filters.
+// The sections of every group are found first, once for each
+// distinct filter set.  Then one pass over those sections, in file
+// order, makes each group's comments then removes (in group order).
+// The adds come last, a group at a time.  A group whose filters
+// matched no section adds to the sections made for an earlier group
+// with the same filters, rather than making another copy.
+// Comments and removes only see the lines the file was read with.
+void applyActions( WholeFile & theFile, const ConfigSetup & cfg,
+		   const std::vector< Actions > & groups )
+{
+  std::vector< FilterSet > required( groups.size() );
+  std::vector< size_t > first( groups.size() ); // with the same filters
+  std::vector< std::vector< size_t > > matching( groups.size() );
+  std::vector< std::pair< size_t, size_t > > visits; // section, group
+  for( size_t g = 0; g < groups.size(); g++ ){
+    required[g].compile( groups[g].requiredFilters, theFile.mFilters );
+    size_t same = 0;
+    while( same < g && required[ same ].sameAs( required[g] ) == false ){
+      same++;
+    }
+    first[g] = same;
+    if( same < g ){
+      matching[g] = matching[ same ];
+    } else {
+      theFile.findMatches( required[g], matching[g] );
+    }
+    if( groups[g].commentCommands.size() || groups[g].removeCommands.size() ){
+      for( auto index = matching[g].begin(); index != matching[g].end(); index++ ){
+	visits.push_back( std::make_pair( *index, g ) );
+      }
+    }
+  }
+  std::sort( visits.begin(), visits.end() );
+  for( auto visit = visits.begin(); visit != visits.end(); visit++ ){
+    Section & section = theFile.mSections[ visit->first ];
+    const Actions & actions = groups[ visit->second ];
+    // comments
+    for( auto cmd = actions.commentCommands.begin();
+	 cmd!= actions.commentCommands.end(); cmd ++ ){
+      theFile.commentLine( section, *cmd );
+    }
+    // deletes
+    for( auto cmd = actions.removeCommands.begin();
+	 cmd!= actions.removeCommands.end(); cmd ++ ){
+      theFile.removeLine( section, *cmd );
+    }
+  }
+  // the section made for each distinct filter set which matched
+  // nothing.  It has the selection re-reading the file would give
+  // it, which is [all] and the filters, so findMatches can't find it.
+  const size_t none = ~size_t( 0 );
+  std::vector< size_t > made( groups.size(), none );
+  size_t sections = theFile.mSections.size();
+  for( size_t g = 0; g < groups.size(); g++ ){
+    if( made[ first[g] ] != none ){
+      matching[g].assign( 1, made[ first[g] ] );
+    } else if( theFile.mSections.size() != sections ){
+      matching[g].clear();
+      theFile.findMatches( required[g], matching[g] );
+    }
+    addLines( theFile, cfg, groups[g], matching[g] );
+    if( matching[g].empty() ){
+      made[ first[g] ] = theFile.mSections.size() - 1;
+    }
+  }
+}
+
+void applyActions( WholeFile & theFile, const ConfigSetup & cfg,
+		   const Actions & actions )
+{
+  applyActions( theFile, cfg, std::vector< Actions >( 1, actions ) );
+}
+//////////////////////////////////////////////////////////
+// writeConfig - replace fileName with theFile, the original
+// is kept as a .bak file until the new one is written.
+//////////////////////////////////////////////////////////
+// Lines which are views of bytes at or after offset of the file
+// about to be patched are copied out, so theFile stays valid (and
+// can't touch the mapping beyond a truncated end).
+static void detachFrom( WholeFile & theFile, const struct stat & st,
+			size_t offset )
+{
+  if( !theFile.mStorage ) return;
+  const struct stat & mapped = theFile.mStorage->status();
+  if( mapped.st_dev != st.st_dev || mapped.st_ino != st.st_ino ) return;
+  theFile.detachFrom( offset );
+}
+
+static bool writeAll( int fd, const std::string & data, off_t offset )
+{
+  size_t done = 0;
+  while( done < data.size() ){
+    ssize_t wrote = pwrite( fd, data.data() + done, data.size() - done,
+			    offset + done );
+    if( wrote < 0 ){
+      if( errno == EINTR ) continue;
+      return false;
+    }
+    done += wrote;
+  }
+  return true;
+}
+
+//////////////////////////////////////////////////////////
+// the journal of a patch - fileName + ".journal", holding what is
+// needed to put the file back as it was:
+//   magic, original size, offset, length, contentHash( bytes ), bytes
+// It is synced before the file is touched, and removed once the
+// patched file has been synced, so one which is found (after a power
+// cut) is rolled back.  A journal which doesn't check out was never
+// completed, and the file never touched.
+static const char journalMagic[8] = { 'c', 'e', 'j', 'r', 'n', 'l', '0', '1' };
+
+static std::string journalName( const std::string & fileName )
+{
+  return fileName + ".journal";
+}
+
+// the directory entry of a new or removed file survives a power cut.
+static void syncDirectory( const std::string & fileName )
+{
+  std::string::size_type pos = fileName.find_last_of( '/' );
+  std::string dir = pos == std::string::npos ? "." :
+    fileName.substr( 0, pos ? pos : 1 );
+  int fd = open( dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+  if( fd < 0 ) return;
+  if( fsync( fd ) != 0 ){
+    // not supported by every file system
+  }
+  close( fd );
+}
+
+static bool writeJournal( const std::string & fileName, size_t size,
+			  size_t offset, std::string_view original )
+{
+  uint64_t header[4] = { size, offset, original.size(),
+			 contentHash( original ) };
+  std::string journal( journalMagic, sizeof( journalMagic ) );
+  journal.append( (const char *)header, sizeof( header ) );
+  journal.append( original );
+  std::string name = journalName( fileName );
+  int fd = open( name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		 0644 );
+  if( fd < 0 ){
+    return false;
+  }
+  bool written = write( fd, journal.data(), journal.size() ) ==
+    (ssize_t)journal.size() && fsync( fd ) == 0;
+  if( close( fd ) != 0 || written == false ){
+    unlink( name.c_str() );
+    return false;
+  }
+  syncDirectory( fileName );
+  return true;
+}
+
+static bool removeJournal( const std::string & fileName )
+{
+  if( unlink( journalName( fileName ).c_str() ) != 0 && errno != ENOENT ){
+    return false;
+  }
+  syncDirectory( fileName );
+  return true;
+}
+
+bool recoverConfig( const std::string & fileName, std::string & error )
+{
+  std::string name = journalName( fileName );
+  MappedFile journal;
+  if( journal.open( name ) == false ){
+    return true; // the usual case - no patch was interrupted
+  }
+  std::string_view contents = journal.contents();
+  uint64_t header[4];
+  if( contents.size() < sizeof( journalMagic ) + sizeof( header ) ||
+      memcmp( contents.data(), journalMagic, sizeof( journalMagic ) ) != 0 ){
+    removeJournal( fileName );
+    return true;
+  }
+  memcpy( header, contents.data() + sizeof( journalMagic ), sizeof( header ) );
+  std::string_view original = contents.substr( sizeof( journalMagic ) +
+					       sizeof( header ) );
+  if( original.size() != header[2] || contentHash( original ) != header[3] ){
+    removeJournal( fileName );
+    return true;
+  }
+  int fd = open( fileName.c_str(), O_WRONLY | O_CLOEXEC );
+  if( fd < 0 ||
+      writeAll( fd, std::string( original ), header[1] ) == false ||
+      ftruncate( fd, header[0] ) != 0 || fsync( fd ) != 0 ){
+    error = "Unable to recover " + fileName + " from " + name + " - " +
+      strerror( errno );
+    if( fd >= 0 ) close( fd );
+    return false;
+  }
+  close( fd );
+  removeJournal( fileName );
+  return true;
+}
+
+//////////////////////////////////////////////////////////
+// patchConfig - update fileName in place, writing only from the
+// first byte which differs from the new contents (to the last
+// differing byte when the size is unchanged).  Saves the write and
+// the wear of rewriting the whole file to change one line.
+// The bytes being replaced are journalled first, put back if the
+// write fails, and recovered by recoverConfig if it is cut short.
+// false, error empty - the file can't be patched (not a regular
+// file), and should be rewritten.
+static bool patchConfig( WholeFile & theFile, const std::string & fileName,
+			 std::string & error, WriteStats * stats )
+{
+  MappedFile current;
+  if( current.open( fileName ) == false ||
+      S_ISREG( current.status().st_mode ) == false ){
+    return false;
+  }
+  std::string_view contents = current.contents();
+  GatherWriter out( -1 );
+  appendConfig( theFile, out, false );
+  size_t newSize = out.pending();
+  size_t start = out.commonPrefix( contents );
+  size_t end = newSize;
+  if( newSize == contents.size() ){
+    end -= out.commonSuffix( contents, newSize - start );
+  }
+  std::string replacement = out.copyRange( start, end );
+  std::string original( contents.substr( start, end - start ) );
+  // only a patch which is on disk, with its journal gone, is reported.
+  auto patched = [&]() {
+    if( stats ){
+      stats->mPatched = true;
+      stats->mOffset = start;
+      stats->mBytesWritten = replacement.size();
+      stats->mFileSize = newSize;
+    }
+    return true;
+  };
+  if( replacement.size() == 0 && newSize == contents.size() ){
+    return patched(); // nothing changed
+  }
+  if( writeJournal( fileName, contents.size(), start, original ) == false ){
+    error = "Unable to write " + journalName( fileName ) + " " +
+      strerror( errno );
+    return false;
+  }
+  detachFrom( theFile, current.status(), start );
+  int fd = open( fileName.c_str(), O_WRONLY | O_CLOEXEC );
+  if( fd < 0 ){
+    error = "Unable to write " + fileName + " " + strerror( errno );
+    removeJournal( fileName );
+    return false;
+  }
+  bool written = writeAll( fd, replacement, start );
+  if( written && newSize != contents.size() ){
+    written = ftruncate( fd, newSize ) == 0;
+  }
+  if( written ){
+    written = fsync( fd ) == 0;
+  }
+  if( written == false ){
+    error = "Unable to write " + fileName + " " + strerror( errno );
+    writeAll( fd, original, start );
+    if( ftruncate( fd, contents.size() ) != 0 || fsync( fd ) != 0 ){
+      // the journal is left, for recoverConfig
+      close( fd );
+      return false;
+    }
+  }
+  if( close( fd ) != 0 && written ){
+    error = "Unable to write " + fileName + " " + strerror( errno );
+    written = false;
+  }
+  // a journal left behind would undo the patch at the next read.
+  if( removeJournal( fileName ) == false ){
+    error = "Unable to remove " + journalName( fileName ) + " " +
+      strerror( errno );
+    return false;
+  }
+  return written ? patched() : false;
+}
+
+std::string backupName( const std::string & fileName )
+{
+  // only a '.' after the last '/' (and not starting the name)
+  // begins an extension.
+  std::string::size_type slash = fileName.find_last_of( '/' );
+  std::string::size_type name = slash == std::string::npos ? 0 : slash + 1;
+  std::string::size_type pos = fileName.find_last_of( '.' );
+  if( pos == std::string::npos || pos <= name ){
+    pos = fileName.length();
+  }
+  return fileName.substr( 0, pos ) + ".bak";
+}
+
+bool writeConfig( WholeFile & theFile, const std::string & fileName,
+		  bool bKeepBackup, std::string & error, WriteStats * stats )
+{
+  theFile.compact();
+  if( bKeepBackup == false ){
+    if( patchConfig( theFile, fileName, error, stats ) ){
+      return true;
+    }
+    if( error.length() ){
+      return false;
+    }
+  }
+  {
+    // the lines are views into the original, which stays mapped
+    // while it is renamed to the backup and the new file is written.
+    std::string bakFile = backupName( fileName );
+    remove( bakFile.c_str() );
+    if( rename( fileName.c_str(), bakFile.c_str() ) != 0 ){
+      error = "Unable to create backup " + bakFile + " - " +
+	strerror( errno ) + " aborting";
+      return false;
+    }
+
+    int fd = open( fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		   0666 );
+    if( fd < 0 ){
+      error = "Unable to write to new file " + fileName + " " +
+	strerror( errno );
+      rename( bakFile.c_str(), fileName.c_str() );
+      return false;
+    }
+    GatherWriter out( fd );
+    bool written = doDisplayConfig( theFile, out, false );
+    if( written ){
+      written = fsync( fd ) == 0;
+    }
+    if( close( fd ) != 0 ){
+      written = false;
+    }
+    if( stats ){
+      stats->mPatched = false;
+      stats->mOffset = 0;
+      stats->mBytesWritten = out.bytesWritten();
+      stats->mFileSize = out.bytesWritten();
+    }
+    if( written == false ){
+      error = "Unable to write " + fileName + " " + strerror( errno );
+      remove( fileName.c_str() );
+      rename( bakFile.c_str(), fileName.c_str() );
+      return false;
+    }
+    if( bKeepBackup == false ){
+      remove( bakFile.c_str() );
+    }
+  }
+  return true;
+}
+bool editConfig( const ConfigSetup & cfg, const std::string & fileName,
+		 const std::vector< Actions > & groups, bool bKeepBackup,
+		 std::string & error, WriteStats * stats )
+{
+  WholeFile theFile;
+  if( readWholeFile( fileName, cfg, theFile ) == false ){
+    error = "Unable to read " + fileName + " - " + strerror( errno );
+    return false;
+  }
+  applyActions( theFile, cfg, groups );
+  return writeConfig( theFile, fileName, bKeepBackup, error, stats );
+}
+bool editConfig( const ConfigSetup & cfg, const std::string & fileName,
+		 const Actions & actions, bool bKeepBackup,
+		 std::string & error, WriteStats * stats )
+{
+  return editConfig( cfg, fileName, std::vector< Actions >( 1, actions ),
+		     bKeepBackup, error, stats );
+}
+
+std::string WriteStats::report() const
+{
+  std::string text = "wrote " + std::to_string( mBytesWritten ) + " of " +
+    std::to_string( mFileSize ) + " bytes";
+  if( mPatched ){
+    text += " at offset " + std::to_string( mOffset ) + " (patch)";
+  } else {
+    text += " (rewrite)";
+  }
+  return text;
+}
+bool editConfig( const ConfigSetup & cfg, const std::string & fileName,
+		 const std::vector< Actions > & groups, bool bKeepBackup )
+{
+  std::string error;
+  if( editConfig( cfg, fileName, groups, bKeepBackup, error ) == false ){
+    if( error.length() ){
+      std::cerr << error << std::endl;
+    }
+    return false;
+  }
+  return true;
+}
+
+//////////////////////////////////////////////////////////
+// the identity of a file which may not exist yet - its device and
+// inode, or those of its directory and its name.  Paths which
+// can't be resolved are compared as written.
+static std::string fileKey( const std::string & fileName )
+{
+  struct stat st;
+  if( stat( fileName.c_str(), &st ) == 0 ){
+    return "f" + std::to_string( st.st_dev ) + ":" + std::to_string( st.st_ino );
+  }
+  std::string::size_type slash = fileName.find_last_of( '/' );
+  std::string dir = slash == std::string::npos ? "." :
+    fileName.substr( 0, slash ? slash : 1 );
+  std::string name = slash == std::string::npos ? fileName :
+    fileName.substr( slash + 1 );
+  if( stat( dir.c_str(), &st ) == 0 ){
+    return "d" + std::to_string( st.st_dev ) + ":" + std::to_string( st.st_ino ) +
+      "/" + name;
+  }
+  return "p" + fileName;
+}
+
+//////////////////////////////////////////////////////////
+// editConfigs - editConfig for each of files, spread over
+// threads workers.  cfg and groups are only read, so are shared
+// by all of them.  A file listed more than once (by any path) is
+// only edited for its first entry, as two workers must not rewrite
+// the same file.  Nor may they share a backup, so files whose
+// backups collide are edited in turn, by one worker - or with
+// bKeepBackup, only the first is edited.
+void editConfigs( const ConfigSetup & cfg,
+		  const std::vector< std::string > & files,
+		  const std::vector< Actions > & groups, bool bKeepBackup,
+		  unsigned threads, std::vector< EditResult > & results )
+{
+  results.assign( files.size(), EditResult() );
+  // the same file, by any path, is only edited once.
+  std::map< std::string, size_t > firstEntry;
+  // entries sharing a backup (foo.txt and foo.conf) are edited one
+  // after another, by one job.
+  std::map< std::string, size_t > backupJob;
+  std::vector< std::vector< size_t > > jobs;
+  for( size_t i = 0; i < files.size(); i++ ){
+    if( firstEntry.insert( std::make_pair( fileKey( files[i] ), i ) ).second == false ){
+      results[i].mError = "listed more than once in the manifest";
+      results[i].mSkipped = true;
+      continue;
+    }
+    std::string backup = backupName( files[i] );
+    auto job = backupJob.insert( std::make_pair( fileKey( backup ), jobs.size() ) );
+    if( job.second ){
+      jobs.push_back( std::vector< size_t >() );
+    } else if( bKeepBackup ){
+      // the backup kept would be of whichever was edited last.
+      results[i].mError = "backup " + backup + " would replace that of " +
+	files[ jobs[ job.first->second ].front() ];
+      continue;
+    }
+    jobs[ job.first->second ].push_back( i );
+  }
+  WorkPool pool( threads );
+  pool.run( jobs.size(), [&]( size_t j ) {
+    for( auto i = jobs[j].begin(); i != jobs[j].end(); i++ ){
+      results[*i].mOk = editConfig( cfg, files[*i], groups, bKeepBackup,
+				    results[*i].mError, &results[*i].mStats );
+    }
+  } );
+}
@@ -0,0 +1,1015 @@
+//////////////////////////////////////////////////////////
+//  config_edit - model of a config.txt file
+#pragma once
+#if ! defined( H_CONFIG_EDIT_H)
+#define H_CONFIG_EDIT_H
+#include <functional>
+#include <string>
+#include <string_view>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <vector>
+#include <iostream>
+#include <sys/stat.h>
+#include "json_lite.h"
+
+//
+// [stuff] # starts a new filter.
+// filter gets more restrictive as extra
+// classes are sequentially added.
+// if a filter is added in the same class as an active filter
+// then that disables the earlier filter, and adds the current filter.
+//
+// [all]  disables all filters
+// [none] selects nothing - items within [none] match nothing.
+//
+
+//////////////////////////////////////////////////
+// Filter
+// models the line which enables a filter.
+// full line is mLine
+// mClass is the class which this filter belongs to.
+// mKey is the value left of the equals sign e.g. gpio4
+// mValue is the value after the equals sign e.g. 1
+// mLine is the line which was parsed to get this data.
+class Filter
+{
+
+public:
+  std::string mClass;
+  std::string mKey;
+  std::string mValue;
+  std::string mLine;
+  bool mEmpty;
+  Filter()
+    : mEmpty( true )
+  {}
+  Filter( const std::string & fltClass, const std::string & key
+	  , const std::string & value, const std::string & line )
+    : mClass( fltClass )
+    , mKey( key )
+    , mValue( value )
+    , mLine( line )
+    , mEmpty( false )
+  {
+  }
+  Filter( const char *keyValue, const char * fltClass )
+    : mClass( fltClass )
+  {
+    std::string str = keyValue;
+    size_t equals = str.find( '=' );
+    if( equals != std::string::npos ){
+      mKey = str.substr( 0,equals );
+      mValue = str.substr( equals+1);
+    } else {
+      mKey = keyValue;
+    }
+    mLine = "[" + str + "]";
+  }
+  static bool parseFilter( std::string_view line, std::string &key,
+		      std::string &value)
+  {
+    // [gpio3=1] key=gpio3  value=1
+    // [0x01243] key=0x1243
+    // [HDMI:0]  key=HDMI:0
+    if( line.length() == 0 || line[0] != '[' ){
+      return false;
+    }
+    std::string _key;
+    std::string _value;
+    enum inputMode {imKey, imValue };
+    inputMode mode = imKey;
+    std::string::size_type pos = 1;
+    while( pos < line.length() ){
+      if( line[pos] == ']' ){
+	if( _key.length()> 0 &&
+	    (mode == imKey || _value.length() > 0 )){
+	  key = _key;
+	  value = _value;
+	  return true;
+	} else {
+	  return false;
+	}
+      } else if( line[pos] == '=' ){
+	if( mode == imValue ){
+	  return false;
+	}
+	mode = imValue;
+      } else {
+	if( mode == imKey ){
+	  _key += line[pos];
+	} else {
+	  _value += line[pos];
+	}
+      }
+      pos++;
+    }
+    return false;
+  }
+};
+
+//////////////////////////////////////////////////////////////////
+// MappedFile - the bytes of a config file.
+// Regular files are mmapped read only, anything else (pipes, empty
+// files) is read into mBuffer.  Lines read from the file are views
+// into contents(), so the MappedFile is shared by every WholeFile
+// built from it, and must outlive them.
+class MappedFile
+{
+  const char * mData;
+  size_t mSize;
+  bool mMapped;
+  std::string mBuffer;
+  struct stat mStatus;
+public:
+  MappedFile()
+    : mData( nullptr )
+    , mSize( 0 )
+    , mMapped( false )
+  {}
+  ~MappedFile();
+  MappedFile( const MappedFile & ) = delete;
+  MappedFile & operator=( const MappedFile & ) = delete;
+  bool open( const std::string & fileName );
+  std::string_view contents() const
+  {
+    return std::string_view( mData, mSize );
+  }
+  // fstat of the file when it was opened.
+  const struct stat & status() const
+  {
+    return mStatus;
+  }
+};
+
+uint64_t contentHash( std::string_view contents );
+
+//////////////////////////////////////////////////////////////////
+// TextArena - the text of lines which aren't in a MappedFile (read
+// from a stream, or made by an edit).  Each line is copied into a
+// large block, followed by a '\n', and blocks never move, so the
+// text stays valid until the arena is destroyed - when it is all
+// released at once.
+class TextArena
+{
+  std::vector< std::unique_ptr< char[] > > mBlocks;
+  size_t mUsed;     // of the last block
+  size_t mSize;     // of the last block
+  size_t mBytes;    // of all the blocks
+public:
+  TextArena()
+    : mUsed( 0 )
+    , mSize( 0 )
+    , mBytes( 0 )
+  {}
+  TextArena( const TextArena & ) = delete;
+  TextArena & operator=( const TextArena & ) = delete;
+  // the copy of text, without its '\n'.
+  std::string_view copyLine( std::string_view text );
+  size_t bytes() const
+  {
+    return mBytes;
+  }
+};
+
+//////////////////////////////////////////////////////////////////
+// Line - one row of a file's line table.
+// The text is a view, either into the MappedFile or into the
+// file's TextArena, so a Line is only a pointer and a length.
+// mNewline - the view is followed by a '\n', so the line can be
+// written out along with its terminator.
+// mRemoved - a tombstone, the line is skipped when written and
+// dropped by WholeFile::compact.
+class Line
+{
+  const char * mText;
+  uint32_t mLength;
+  bool mNewline;
+  bool mRemoved;
+public:
+  Line()
+    : mText( "" )
+    , mLength( 0 )
+    , mNewline( false )
+    , mRemoved( false )
+  {}
+  Line( std::string_view text, bool newlineFollows )
+    : mText( text.data() )
+    , mLength( text.size() )
+    , mNewline( newlineFollows )
+    , mRemoved( false )
+  {}
+  std::string_view view() const
+  {
+    return std::string_view( mText, mLength );
+  }
+  // the line with its '\n', if the storage holds one.
+  bool terminated( std::string_view & withNewline ) const
+  {
+    if( mNewline == false ){
+      return false;
+    }
+    withNewline = std::string_view( mText, mLength + 1 );
+    return true;
+  }
+  bool isRemoved() const
+  {
+    return mRemoved;
+  }
+  void remove()
+  {
+    mRemoved = true;
+  }
+  bool operator==( std::string_view rhs ) const
+  {
+    return view() == rhs;
+  }
+};
+inline std::ostream & operator<<( std::ostream & out, const Line & line )
+{
+  return out << line.view();
+}
+
+//////////////////////////////////////////////////////////////////
+// GatherWriter - collects output as a list of pieces, and writes
+// them with as few writev calls as possible.
+// append() - the bytes must stay valid until flush(), pieces which
+//            are contiguous in memory are merged.
+// appendCopy() - bytes are copied to mScratch (for generated text).
+class GatherWriter
+{
+  struct Piece {
+    const char * mBase;   // nullptr - offset into mScratch
+    size_t mOffset;
+    size_t mLength;
+  };
+  int mFd;
+  std::vector< Piece > mPieces;
+  std::string mScratch;
+  size_t mPending;
+  size_t mWriteCalls;
+  size_t mBytesWritten;
+  bool mFailed;
+public:
+  GatherWriter( int fd )
+    : mFd( fd )
+    , mPending( 0 )
+    , mWriteCalls( 0 )
+    , mBytesWritten( 0 )
+    , mFailed( false )
+  {}
+  void append( std::string_view text );
+  void appendCopy( std::string_view text );
+  void prependCopy( std::string_view text );
+  bool flush();
+  size_t commonPrefix( std::string_view original ) const;
+  size_t commonSuffix( std::string_view original, size_t limit ) const;
+  // the pending output from offset from, up to offset to.
+  std::string copyRange( size_t from, size_t to ) const;
+  // bytes appended since the last flush.
+  size_t pending() const
+  {
+    return mPending;
+  }
+  size_t writeCalls() const
+  {
+    return mWriteCalls;
+  }
+  size_t bytesWritten() const
+  {
+    return mBytesWritten;
+  }
+};
+
+//////////////////////////////////////////////////////////////////
+// FilterTable - gives each distinct filter (class, key, value)
+// of a file a small integer id.
+class FilterTable
+{
+  std::unordered_map< std::string, uint32_t > mIds;
+public:
+  uint32_t intern( const Filter & flt );
+  size_t size() const
+  {
+    return mIds.size();
+  }
+};
+
+//////////////////////////////////////////////////////////////////
+// FilterSet - a list of Filters compiled against a FilterTable.
+// mIds - sorted, without repeats.
+// mMask - bit ( id % 64 ) for each id, when mExact (all ids < 64)
+//         the mask alone is the set.
+// mCount - the number of filters compiled, including repeats.
+// mAll - a single [all] filter.
+class FilterSet
+{
+public:
+  uint64_t mMask;
+  std::vector< uint32_t > mIds;
+  uint32_t mCount;
+  bool mExact;
+  bool mAll;
+  FilterSet()
+    : mMask( 0 )
+    , mCount( 0 )
+    , mExact( true )
+    , mAll( false )
+  {}
+  void compile( const std::vector< Filter > & filters, FilterTable & table );
+  bool sameAs( const FilterSet & rhs ) const
+  {
+    return mIds == rhs.mIds && mCount == rhs.mCount && mAll == rhs.mAll;
+  }
+  bool subsetOf( const FilterSet & rhs ) const
+  {
+    if( mMask & ~rhs.mMask ) return false;
+    if( mExact && rhs.mExact ) return true;
+    auto r = rhs.mIds.begin();
+    for( auto it = mIds.begin(); it != mIds.end(); it++ ){
+      while( r != rhs.mIds.end() && *r < *it ) r++;
+      if( r == rhs.mIds.end() || *r != *it ) return false;
+    }
+    return true;
+  }
+};
+
+//////////////////////////////////////////////////////////////////
+// Selection - an immutable set of active filters, as a list from
+// the filter added last (mFilter, the entry filter of a section)
+// back through mParent.  Oldest first, the filters are
+// mParent's then mFilter.
+// Selections are only made by a SelectionPool, which never makes
+// two with the same filters in the same order - so selections can
+// be compared by pointer, and consecutive sections share them.
+// mIds - the filters, compiled against the file's FilterTable.
+class Selection
+{
+public:
+  std::shared_ptr< const Filter > mFilter;
+  std::shared_ptr< const Selection > mParent;
+  size_t mSize;
+  FilterSet mIds;
+  template < class Fn >
+  void forEach( Fn fn ) const
+  {
+    if( mParent ) mParent->forEach( fn );
+    fn( *mFilter );
+  }
+};
+// null is the empty selection.
+typedef std::shared_ptr< const Selection > SelectionRef;
+
+//////////////////////////////////////////////////////////////////
+// SelectionPool - hash conses the selections (and their filters)
+// of a file.
+class SelectionPool
+{
+  struct NodeHash {
+    size_t operator()( const std::pair< const Selection *, const Filter * > & key ) const
+    {
+      return std::hash< const void * >()( key.first ) * 31 +
+	std::hash< const void * >()( key.second );
+    }
+  };
+  // class '\0' line, as the line gives the key and value.
+  std::unordered_map< std::string, std::shared_ptr< const Filter > > mFilters;
+  std::unordered_map< std::pair< const Selection *, const Filter * >,
+		      SelectionRef, NodeHash > mNodes;
+  SelectionRef node( const SelectionRef & parent,
+		     const std::shared_ptr< const Filter > & flt,
+		     FilterTable & table );
+public:
+  // selection with the filter on line made active - replacing the
+  // active filter of fltClass, or all of them for "super".
+  SelectionRef add( const SelectionRef & selection, const std::string & fltClass,
+		    const std::string & key, const std::string & value,
+		    std::string_view line, FilterTable & table );
+  size_t size() const
+  {
+    return mNodes.size();
+  }
+};
+
+//////////////////////////////////////////////////////////////////
+// LineIndex - hash table from line text to the positions of the
+// lines in a section, so a --comment or --remove costs O(1) rather
+// than a scan of the section.
+// Open addressing: a slot holds a position and the hash of that
+// line; the text itself is always compared against the line, so
+// the table stays valid when the lines vector moves.
+class LineIndex
+{
+  struct Slot {
+    uint32_t mPos;
+    uint32_t mHash;
+  };
+  static const uint32_t empty = 0xffffffff;
+  static const uint32_t deleted = 0xfffffffe;
+  std::vector< Slot > mSlots;
+  size_t mUsed;   // slots which are not empty
+  size_t mLive;
+  bool mBuilt;
+  void grow();
+public:
+  LineIndex()
+    : mUsed( 0 )
+    , mLive( 0 )
+    , mBuilt( false )
+  {}
+  static uint32_t hash( std::string_view text )
+  {
+    return (uint32_t)std::hash< std::string_view >()( text );
+  }
+  bool built() const
+  {
+    return mBuilt;
+  }
+  void build( const Line * lines, size_t count );
+  void clear();
+  void insert( uint32_t pos, std::string_view text );
+  void erase( uint32_t pos, std::string_view text );
+  // positions of the lines equal to text, in no particular order.
+  template < class Fn >
+  void find( std::string_view text, const Line * lines, Fn fn ) const
+  {
+    if( mSlots.size() == 0 ) return;
+    uint32_t h = hash( text );
+    size_t mask = mSlots.size() - 1;
+    for( size_t i = h & mask; mSlots[i].mPos != empty; i = ( i + 1 ) & mask ){
+      const Slot & slot = mSlots[i];
+      if( slot.mPos != deleted && slot.mHash == h &&
+	  lines[ slot.mPos ] == text ){
+	fn( slot.mPos );
+      }
+    }
+  }
+};
+
+class ConfigSetup;
+class WholeFile;
+///////////////////////////////////////////////////////////////////
+// section - created each time the filter changes.
+// describes the lines with a specific filter-set added.
+// mSelection - the filters which are active, shared with the other
+//   sections of the file which have the same ones.
+// entryFilter() - the filter which started this section.  (null for
+//   the first section)
+// mFirst, mCount - the lines of the section, in the file's line
+//   table.  Rows up to mCapacity are reserved for it.
+// The lines must only be changed through WholeFile once mLineIndex
+// is built.
+class Section
+{
+public:
+  SelectionRef mSelection;            // which filters are active...
+  uint32_t mFirst;
+  uint32_t mCount;
+  uint32_t mCapacity;
+  // the selections are made by file's pool.
+  bool sectionChange( std::string_view line, const ConfigSetup & config,
+		      WholeFile & file );
+  LineIndex mLineIndex;               // built by the first edit
+  uint32_t mRemovedLines;             // tombstones in the lines
+  Section()
+    : mFirst( 0 )
+    , mCount( 0 )
+    , mCapacity( 0 )
+    , mRemovedLines( 0 )
+  {}
+  const Filter * entryFilter() const
+  {
+    return mSelection ? mSelection->mFilter.get() : nullptr;
+  }
+  const FilterSet & selectionIds() const
+  {
+    static const FilterSet none;
+    return mSelection ? mSelection->mIds : none;
+  }
+  //////////////////////////////////////////////////////////
+  // the section's lines apply to requiredFilters
+  // - nothing required: only the unfiltered and [all] sections.
+  // - an unfiltered section matches [all], or more than one filter.
+  // - otherwise every active filter must be required.
+  bool matches( const FilterSet & requiredFilters ) const
+  {
+    if( requiredFilters.mCount == 0 ){
+      return !mSelection || mSelection->mIds.mAll;
+    }
+    if( !mSelection ){
+      return requiredFilters.mCount > 1 || requiredFilters.mAll;
+    }
+    return mSelection->mIds.subsetOf( requiredFilters );
+  }
+  bool isAll()
+  {
+    return !mSelection || mSelection->mIds.mAll;
+  }
+};
+
+//////////////////////////////////////////////////////////////////
+// LineRange - the lines of one section.
+template < class T >
+struct LineRange
+{
+  T * mBegin;
+  T * mEnd;
+  T * begin() const
+  {
+    return mBegin;
+  }
+  T * end() const
+  {
+    return mEnd;
+  }
+  size_t size() const
+  {
+    return mEnd - mBegin;
+  }
+};
+
+//////////////////////////////////////////////////////////////////
+// WholeFile - the sections of a config file, in order.
+// Sections must be added with appendSection, which keeps the
+// signature index up to date:
+// mIndex - hash of a selection's ids, to the sections which have
+//          that selection (in file order).
+// mAllSections - the sections selected by a single [all].
+// mLines - the line table, each section's lines are a range of it.
+//          In file order when read; a section which outgrows its
+//          rows moves to the end, with room to grow, and compact()
+//          puts the table back in order.
+// mArena - line text which isn't in mStorage.  A copy of a
+//          WholeFile shares it, so a copy is a cheap snapshot, but
+//          only one copy at a time may be edited.
+class WholeFile
+{
+  std::unordered_map< uint64_t, std::vector< size_t > > mIndex;
+  std::vector< size_t > mAllSections;
+  std::vector< Line > mLines;
+  std::shared_ptr< TextArena > mArena;
+public:
+  std::vector<Section> mSections;
+  // keeps the mapping alive for any Line which is a view into it.
+  std::shared_ptr<MappedFile> mStorage;
+  FilterTable mFilters;
+  SelectionPool mSelections;
+  static uint64_t signature( const uint32_t * ids, size_t count );
+  void appendSection( Section && section );
+  // section must have no lines, or they would be shared.
+  void appendSection( const Section & section )
+  {
+    appendSection( Section( section ) );
+  }
+  LineRange< const Line > lines( const Section & section ) const
+  {
+    const Line * first = mLines.data() + section.mFirst;
+    return LineRange< const Line >{ first, first + section.mCount };
+  }
+  LineRange< Line > lines( Section & section )
+  {
+    Line * first = mLines.data() + section.mFirst;
+    return LineRange< Line >{ first, first + section.mCount };
+  }
+  size_t lineRows() const
+  {
+    return mLines.size();
+  }
+  // held by the text of edited lines, which is only freed with the
+  // WholeFile.
+  size_t arenaBytes() const
+  {
+    return mArena ? mArena->bytes() : 0;
+  }
+  // text copied into mArena.
+  std::string_view copyLine( std::string_view text );
+  // line added to the end of section, which need not be in
+  // mSections yet.
+  void appendLine( Section & section, const Line & line );
+  // comment out every line of section equal to text.
+  void commentLine( Section & section, std::string_view text );
+  // remove the first line of section equal to text.
+  bool removeLine( Section & section, std::string_view text );
+  void addLine( Section & section, const std::string & text );
+  // copy the lines which are views of the mapping from offset on
+  // into mArena.
+  void detachFrom( size_t offset );
+  // the indices of the sections which match required, in order.
+  void findMatches( const FilterSet & required,
+		    std::vector< size_t > & found ) const;
+  void resetToAll()
+  {
+    if( mSections.size() == 0 ) return;
+    Section & last = mSections[ mSections.size() -1 ];
+    if( last.isAll() ) return;
+    Section all;
+    all.mSelection = mSelections.add( nullptr, "super", "all", "", "[all]",
+				      mFilters );
+    appendSection( std::move( all ) );
+  }
+  void addLine( const std::string & line )
+  {
+    if( mSections.size() == 0 ){
+      Section newSection;
+      appendSection( std::move( newSection ) );
+    }
+    addLine( mSections[mSections.size()-1], line );
+  }
+  // drop the removed lines, and the rows no section uses.
+  void compact();
+};
+
+class Description
+{
+  std::string mBase;
+  std::string mParam;
+public:
+  Description()
+  {}
+  Description( std::string_view str )
+  {
+    std::string s( str );
+    std::string::size_type pos = s.find( '%' );
+    if( pos != std::string::npos ){
+      mBase = s.substr(0,pos );
+      mParam = s.substr( pos+1);
+    } else {
+      mBase = s;
+    }
+    //printf( "base = %s, pattern = %s\n", mBase.c_str(), mParam.c_str() );
+  }
+  const std::string & base() const
+  {
+    return mBase;
+  }
+  const std::string &param() const
+  {
+    return mParam;
+  }
+};
+
+
+//////////////////////////////////////////////////////////
+// filter value patterns - literal text, with
+//   %d %x       any number of decimal / hex digits (gpio%d, 0x%x)
+//   %8d %8x     exactly that many
+//   %{0-27}     a decimal number in the range
+//   %(a|b|c)    one of the alternatives
+//   %%          a literal %
+// The base of a pattern is the literal text before the first %.
+bool patternValid( std::string_view pattern );
+bool patternMatches( std::string_view pattern, std::string_view key );
+
+class ConfigValue
+{
+public:
+  Description mDesc;
+  std::string mClass;
+  std::string mPattern;
+  ConfigValue( std::string_view value )
+    : mDesc( value )
+    , mPattern( value )
+  {}
+  ConfigValue()
+  {}
+  bool isValid( std::string_view key ) const
+  {
+    return patternMatches( mPattern, key );
+  }
+};
+
+class ConfigClass
+{
+  Description mDesc;
+
+public:
+  std::vector< ConfigValue > mValues;
+  ConfigClass()
+  {}
+  // str need not be null terminated.
+  ConfigClass( const char * str, size_t len )
+    : mDesc( std::string_view( str, len ) )
+  {}
+  const std::string & className() const
+  {
+    return mDesc.base();
+  }
+};
+//////////////////////////////////////////////////////////
+// schema - the built in filter classes, as json (for --help and
+// anything wanting to parse it) and as a table of (class, value)
+// pairs read from that json at compile time.  defaultConfig() is
+// made from the table, so a run without --config parses nothing.
+// Only the table is constant - the ConfigSetup's maps and KeyMatcher
+// are still built from it on each run.
+// The parser only takes the shape the default has - an object of
+// arrays of strings, without escapes.
+// A class with no values is one entry whose mValue.data() is nullptr.
+struct SchemaEntry
+{
+  std::string_view mClass;
+  std::string_view mValue;
+};
+
+// sigh - after reading json spec.  All "strings" are quoted with "
+//
+//  So this looks less nice.  However, should aid flexibility....
+inline constexpr std::string_view defaultConfigJson =
+  R"##config( {
+  "platform"  : [ "pi0", "pi0w" , "pi1", "pi2", "pi3", "pi3+", "pi4" ],
+  "super" :     [ "all", "none" ],
+  "edid" :      [ "edid" ],
+  "cpuserial" : [ "0x%x" ], 
+  "hdmi" :      [ "HDMI:0", "HDMI:1" ],
+  "gpio" :      [ "gpio%d" ] 
+  })##config";
+
+namespace schema
+{
+  template< size_t N >
+  struct Table
+  {
+    SchemaEntry mEntries[ N ];
+    size_t mCount;
+    bool mValid;
+  };
+  constexpr size_t skipSpace( std::string_view json, size_t pos )
+  {
+    while( pos < json.size() && ( json[ pos ] == ' ' || json[ pos ] == '\t' ||
+				  json[ pos ] == '\n' || json[ pos ] == '\r' ) ){
+      pos++;
+    }
+    return pos;
+  }
+  // the string starting at pos (a '"'), pos left after it.
+  constexpr bool quoted( std::string_view json, size_t & pos,
+			 std::string_view & text )
+  {
+    if( pos >= json.size() || json[ pos ] != '"' ) return false;
+    size_t end = pos + 1;
+    while( end < json.size() && json[ end ] != '"' ){
+      if( json[ end ] == '\\' ) return false;
+      end++;
+    }
+    if( end == json.size() ) return false;
+    text = json.substr( pos + 1, end - pos - 1 );
+    pos = end + 1;
+    return true;
+  }
+  // Table with room for N entries, or N == 0 to just count them.
+  template< size_t N >
+  constexpr Table< N ? N : 1 > parse( std::string_view json )
+  {
+    Table< N ? N : 1 > table{};
+    size_t pos = skipSpace( json, 0 );
+    if( pos == json.size() || json[ pos++ ] != '{' ) return table;
+    pos = skipSpace( json, pos );
+    bool first = true;
+    while( pos < json.size() && json[ pos ] != '}' ){
+      if( first == false ){
+	if( json[ pos++ ] != ',' ) return table;
+	pos = skipSpace( json, pos );
+      }
+      first = false;
+      std::string_view className;
+      if( quoted( json, pos, className ) == false ) return table;
+      pos = skipSpace( json, pos );
+      if( pos == json.size() || json[ pos++ ] != ':' ) return table;
+      pos = skipSpace( json, pos );
+      if( pos == json.size() || json[ pos++ ] != '[' ) return table;
+      pos = skipSpace( json, pos );
+      bool firstValue = true;
+      while( pos < json.size() && json[ pos ] != ']' ){
+	if( firstValue == false ){
+	  if( json[ pos++ ] != ',' ) return table;
+	  pos = skipSpace( json, pos );
+	}
+	firstValue = false;
+	std::string_view value;
+	if( quoted( json, pos, value ) == false ) return table;
+	if( N ){
+	  if( table.mCount == N ) return table;
+	  table.mEntries[ table.mCount ] = SchemaEntry{ className, value };
+	}
+	table.mCount++;
+	pos = skipSpace( json, pos );
+      }
+      if( pos == json.size() ) return table;
+      pos = skipSpace( json, pos + 1 );
+    }
+    if( pos == json.size() ) return table;
+    table.mValid = skipSpace( json, pos + 1 ) == json.size();
+    return table;
+  }
+  inline constexpr auto defaultTable =
+    parse< parse< 0 >( defaultConfigJson ).mCount >( defaultConfigJson );
+  static_assert( defaultTable.mValid, "defaultConfigJson isn't a schema" );
+}
+
+//////////////////////////////////////////////////////////
+// KeyMatcher - every value's pattern compiled into one DFA, so
+// findValue classifies a key in a single pass over it.
+// Bytes which no pattern tells apart share a column of mNext.
+// State 0 matches nothing, state 1 is the start.  When a key could
+// match more than one pattern, the one with the longest base wins,
+// then the later value.
+class KeyMatcher
+{
+  std::vector< ConfigValue > mValues;
+  uint8_t mByteClass[ 256 ];
+  uint32_t mClasses;
+  std::vector< uint32_t > mNext;     // [ state * mClasses + class ]
+  std::vector< int32_t > mAccept;    // index into mValues, or -1
+public:
+  KeyMatcher()
+    : mClasses( 0 )
+  {}
+  // false - one of values has an invalid pattern.
+  bool build( const std::vector< ConfigValue > & values, std::string & error );
+  // the compiled form, for the schema cache to save and load.
+  // mNext has mStates * mClasses entries, mAccept mStates.
+  struct Tables
+  {
+    const uint8_t * mByteClass;
+    uint32_t mClasses;
+    uint32_t mStates;
+    const uint32_t * mNext;
+    const int32_t * mAccept;
+  };
+  Tables tables() const
+  {
+    return Tables{ mByteClass, mClasses, uint32_t( mAccept.size() ),
+		   mNext.data(), mAccept.data() };
+  }
+  // tables of a matcher built from values, without building it again.
+  // false - they don't fit values (or each other).
+  bool load( std::vector< ConfigValue > values, const Tables & tables );
+  const ConfigValue * find( std::string_view key ) const
+  {
+    if( mAccept.size() == 0 ){
+      return nullptr;
+    }
+    uint32_t state = 1;
+    for( size_t i = 0; i < key.length() && state; i++ ){
+      state = mNext[ state * mClasses + mByteClass[ (unsigned char)key[i] ] ];
+    }
+    return mAccept[ state ] < 0 ? nullptr : &mValues[ mAccept[ state ] ];
+  }
+};
+
+class ConfigSetup
+{
+  bool mError;
+  std::string mErrorMessage;
+  KeyMatcher mMatcher;
+  std::vector< ConfigValue > loadValues( const SchemaEntry * entries,
+					 size_t count );
+public:
+  std::map< std::string, ConfigValue> mAllConfigs;
+  ConfigSetup()
+    : mError( false )
+  {}
+  std::map<std::string, ConfigClass> mConfigs;
+  void setError( const char * message = nullptr )
+  {
+    mError = true;
+    if( message ) {
+      mErrorMessage = message;
+    }
+  }
+  bool isValid() const
+  {
+    return mError == false;
+  }
+  const std::string & error() const
+  {
+    return mErrorMessage;
+  }
+  // root - an object of class name : [ values ]
+  bool load( const json_lite::Value & root );
+  // the same, from a table grouped by class.
+  bool load( const SchemaEntry * entries, size_t count );
+  // and with the matcher's tables, as matcher().tables() gave them
+  // for the same entries.
+  bool load( const SchemaEntry * entries, size_t count,
+	     const KeyMatcher::Tables & tables );
+  const KeyMatcher & matcher() const
+  {
+    return mMatcher;
+  }
+
+  // the value whose pattern key matches.
+  const ConfigValue * findValue( std::string_view key ) const
+  {
+    return mMatcher.find( key );
+  }
+  bool findValue( const std::string & key, ConfigValue & val ) const
+  {
+    const ConfigValue * found = findValue( std::string_view( key ) );
+    if( found == nullptr ){
+      return false;
+    }
+    val = *found;
+    return true;
+  }
+};
+
+//////////////////////////////////////////////////////////
+// Actions - one group of edits, made to the sections which match
+// requiredFilters.  An edit can have several groups (--then), all
+// applied to one read of the file, and written once.
+struct Actions
+{
+  std::vector< Filter > requiredFilters;
+  std::vector< std::string> addCommands;
+  std::vector< std::string> removeCommands;
+  std::vector< std::string> commentCommands;
+};
+
+ConfigSetup buildConfig( const char * config );
+// the built in schema - equivalent to buildConfig( defaultConfigJson ),
+// without the parse.
+ConfigSetup defaultConfig();
+// --config - the schema in jsonFile.  It is loaded from the compiled
+// form in jsonFile + ".cache" when that was made from the same json
+// (by content hash), otherwise parsed, and the cache rewritten if
+// the directory allows.
+bool loadConfig( const std::string & jsonFile, ConfigSetup & config,
+		 std::string & error, bool * fromCache = nullptr );
+// line by line reader, lines are owned by the Section.
+WholeFile readWholeFile( std::istream & input, const ConfigSetup & config);
+// zero-copy reader, lines are views into storage.
+WholeFile readWholeFile( const std::shared_ptr<MappedFile> & storage,
+			 const ConfigSetup & config );
+// rolls back a patch of fileName which was cut short first.
+bool readWholeFile( const std::string & fileName, const ConfigSetup & config,
+		    WholeFile & theFile );
+bool doDisplayConfig( const WholeFile & theFile,
+		      std::ostream & out, bool bVerbose );
+void appendConfig( const WholeFile & theFile,
+		   GatherWriter & out, bool bVerbose );
+// --print --json
+void appendConfigJson( const WholeFile & theFile, GatherWriter & out );
+bool doDisplayConfig( const WholeFile & theFile,
+		      GatherWriter & out, bool bVerbose );
+bool doDisplayConfig( const WholeFile & theFile, int fd, bool bVerbose );
+void displayConfig( const ConfigSetup & setup, const std::string & fileName,
+		    bool bJson = false );
+void applyActions( WholeFile & theFile, const ConfigSetup & cfg,
+		   const std::vector< Actions > & groups );
+void applyActions( WholeFile & theFile, const ConfigSetup & cfg,
+		   const Actions & actions );
+//////////////////////////////////////////////////////////
+// WriteStats - what writeConfig did.
+// mPatched - the file was updated in place from mOffset, rather
+// than replaced.
+struct WriteStats
+{
+  bool mPatched;
+  size_t mOffset;
+  size_t mBytesWritten;
+  size_t mFileSize;
+  WriteStats()
+    : mPatched( false )
+    , mOffset( 0 )
+    , mBytesWritten( 0 )
+    , mFileSize( 0 )
+  {}
+  std::string report() const;
+};
+// fileName with its extension replaced by .bak - the copy a rewrite
+// keeps until the new file is written, or with bKeepBackup after.
+std::string backupName( const std::string & fileName );
+// Without bKeepBackup the file is patched in place where possible,
+// with the bytes it replaces journalled until the patch is synced.
+// recoverConfig - put back a patch of fileName which didn't finish.
+bool recoverConfig( const std::string & fileName, std::string & error );
+bool writeConfig( WholeFile & theFile, const std::string & fileName,
+		  bool bKeepBackup, std::string & error,
+		  WriteStats * stats = nullptr );
+bool editConfig( const ConfigSetup & cfg, const std::string & fileName,
+		 const std::vector< Actions > & groups, bool bKeepBackup );
+bool editConfig( const ConfigSetup & cfg, const std::string & fileName,
+		 const std::vector< Actions > & groups, bool bKeepBackup,
+		 std::string & error, WriteStats * stats = nullptr );
+bool editConfig( const ConfigSetup & cfg, const std::string & fileName,
+		 const Actions & actions, bool bKeepBackup,
+		 std::string & error, WriteStats * stats = nullptr );
+
+struct EditResult
+{
+  bool mOk;
+  bool mSkipped;
+  std::string mError;
+  WriteStats mStats;
+  EditResult()
+    : mOk( false )
+    , mSkipped( false )
+  {}
+};
+void editConfigs( const ConfigSetup & cfg,
+		  const std::vector< std::string > & files,
+		  const std::vector< Actions > & groups, bool bKeepBackup,
+		  unsigned threads, std::vector< EditResult > & results );
+#endif
@@ -0,0 +1,380 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "config_server.h"
+#include "options.h"
+
+// seconds each write of a response may wait for the client to read.
+static const time_t sendTimeout = 2;
+// the most edited text kept in a cached file.
+static const size_t maxArena = 4 * 1024 * 1024;
+
+static bool sameFile( const struct stat & st, dev_t dev, ino_t ino, off_t size,
+		      const struct timespec & mtime )
+{
+  return st.st_dev == dev && st.st_ino == ino && st.st_size == size &&
+    st.st_mtim.tv_sec == mtime.tv_sec && st.st_mtim.tv_nsec == mtime.tv_nsec;
+}
+
+bool ConfigCache::load( const std::string & fileName, Entry & entry,
+			std::string & error )
+{
+  if( recoverConfig( fileName, error ) == false ){
+    return false;
+  }
+  std::shared_ptr<MappedFile> storage = std::make_shared<MappedFile>();
+  if( storage->open( fileName ) == false ){
+    error = "Unable to read " + fileName + " - " + strerror( errno );
+    return false;
+  }
+  const struct stat & st = storage->status();
+  entry.mFile = readWholeFile( storage, mConfig );
+  entry.mDev = st.st_dev;
+  entry.mIno = st.st_ino;
+  entry.mSize = st.st_size;
+  entry.mMtime = st.st_mtim;
+  entry.mHash = contentHash( storage->contents() );
+  entry.mVerifiedAt = time( nullptr );
+  mReloads++;
+  return true;
+}
+
+WholeFile * ConfigCache::get( const std::string & fileName, std::string & error )
+{
+  struct stat st;
+  if( stat( fileName.c_str(), &st ) != 0 ){
+    error = "Unable to read " + fileName + " - " + strerror( errno );
+    forget( fileName );
+    return nullptr;
+  }
+  auto it = mEntries.find( fileName );
+  if( it != mEntries.end() ){
+    Entry & entry = it->second;
+    if( sameFile( st, entry.mDev, entry.mIno, entry.mSize, entry.mMtime ) ){
+      if( entry.mVerifiedAt >= st.st_mtim.tv_sec + 2 ){
+	mHits++;
+	return &entry.mFile;
+      }
+      // could have been rewritten within the same mtime tick.
+      MappedFile current;
+      time_t now = time( nullptr );
+      if( current.open( fileName ) &&
+	  contentHash( current.contents() ) == entry.mHash ){
+	entry.mVerifiedAt = now;
+	mHits++;
+	return &entry.mFile;
+      }
+    }
+  }
+  Entry & entry = mEntries[ fileName ];
+  if( load( fileName, entry, error ) == false ){
+    mEntries.erase( fileName );
+    return nullptr;
+  }
+  return &entry.mFile;
+}
+
+void ConfigCache::updated( const std::string & fileName )
+{
+  auto it = mEntries.find( fileName );
+  if( it == mEntries.end() ) return;
+  Entry & entry = it->second;
+  MappedFile current;
+  time_t now = time( nullptr );
+  if( current.open( fileName ) == false ){
+    mEntries.erase( it );
+    return;
+  }
+  const struct stat & st = current.status();
+  entry.mDev = st.st_dev;
+  entry.mIno = st.st_ino;
+  entry.mSize = st.st_size;
+  entry.mMtime = st.st_mtim;
+  entry.mHash = contentHash( current.contents() );
+  entry.mVerifiedAt = now;
+}
+
+void ConfigCache::forget( const std::string & fileName )
+{
+  mEntries.erase( fileName );
+}
+
+bool RequestHandler::StartArray()
+{
+  if( mDepth++ != 0 ){
+    setError( "Unexpected StartArray" );
+    return false;
+  }
+  return true;
+}
+
+bool RequestHandler::EndArray()
+{
+  mDepth--;
+  return true;
+}
+
+bool RequestHandler::String( const char * str, size_t len )
+{
+  if( mDepth != 1 ){
+    setError( "Unexpected String" );
+    return false;
+  }
+  mBytes += len;
+  if( mBytes > maxRequest ){
+    setError( "Request too long" );
+    return false;
+  }
+  mArgs.push_back( std::string( str, len ) );
+  return true;
+}
+
+ConfigServer::ConfigServer( const ConfigSetup & config )
+  : mConfig( config )
+  , mCache( config )
+  , mListen( -1 )
+{
+  mWake[0] = mWake[1] = -1;
+}
+
+ConfigServer::~ConfigServer()
+{
+  for( auto it = mClients.begin(); it != mClients.end(); it++ ){
+    close( (*it)->mFd );
+  }
+  if( mListen >= 0 ){
+    close( mListen );
+    unlink( mPath.c_str() );
+  }
+  if( mWake[0] >= 0 ){
+    close( mWake[0] );
+    close( mWake[1] );
+  }
+}
+
+bool ConfigServer::open( const std::string & socketPath, std::string & error )
+{
+  struct sockaddr_un addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sun_family = AF_UNIX;
+  if( socketPath.length() >= sizeof( addr.sun_path ) ){
+    error = "Socket path too long " + socketPath;
+    return false;
+  }
+  strcpy( addr.sun_path, socketPath.c_str() );
+  // only replace a stale socket, never some other file.
+  struct stat st;
+  if( lstat( socketPath.c_str(), &st ) == 0 && S_ISSOCK( st.st_mode ) ){
+    unlink( socketPath.c_str() );
+  }
+  if( pipe2( mWake, O_CLOEXEC ) != 0 ){
+    error = std::string( "Unable to create pipe - " ) + strerror( errno );
+    return false;
+  }
+  mListen = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+  if( mListen < 0 ){
+    error = std::string( "Unable to create socket - " ) + strerror( errno );
+    return false;
+  }
+  if( bind( mListen, (struct sockaddr *)&addr, sizeof( addr ) ) != 0 ||
+      listen( mListen, 16 ) != 0 ){
+    error = "Unable to listen on " + socketPath + " - " + strerror( errno );
+    close( mListen );
+    mListen = -1;
+    return false;
+  }
+  mPath = socketPath;
+  return true;
+}
+
+bool ConfigServer::respond( bool ok, GatherWriter & out )
+{
+  std::string header = ok ? "ok " : "error ";
+  header += std::to_string( out.pending() );
+  header += '\n';
+  out.prependCopy( header );
+  return out.flush();
+}
+
+bool ConfigServer::request( int fd, const std::string & line )
+{
+  RequestHandler handler;
+  json_lite::BufferInputStream strStream( line );
+  json_lite::BufferReader rdr( handler, strStream, true );
+  return request( fd, rdr.read( true ), handler );
+}
+
+bool ConfigServer::request( int fd, bool parsed, const RequestHandler & handler )
+{
+  GatherWriter out( fd );
+  if( parsed == false || handler.mError || handler.mArgs.size() == 0 ){
+    out.appendCopy( "Request must be a json array of arguments" );
+    return respond( false, out );
+  }
+  Options options;
+  std::string error;
+  if( parseOptions( handler.mArgs, options ) == false ){
+    error = "Invalid options";
+  } else if( options.bHelp || options.manifest.length() ||
+	     options.socketPath.length() || options.configFile.length() ){
+    error = "--help, --batch, --daemon and --config can't be requested";
+  } else if( options.bJson && options.bPrintMode == false ){
+    error = "--json can only be used with --print";
+  } else {
+    validateFilters( mConfig, options.groups, error );
+  }
+  if( error.length() ){
+    out.appendCopy( error );
+    return respond( false, out );
+  }
+  WholeFile * theFile = mCache.get( options.file, error );
+  if( theFile == nullptr ){
+    out.appendCopy( error );
+    return respond( false, out );
+  }
+  if( options.bPrintMode ){
+    if( options.bJson ){
+      appendConfigJson( *theFile, out );
+    } else {
+      appendConfig( *theFile, out, true );
+    }
+    return respond( true, out );
+  }
+  applyActions( *theFile, mConfig, options.groups );
+  WriteStats stats;
+  if( writeConfig( *theFile, options.file, options.bKeepBackup, error,
+		   &stats ) ){
+    // the edited lines' text is only freed with the WholeFile, so
+    // a file edited many times is re-read, rather than kept growing.
+    if( theFile->arenaBytes() > maxArena ){
+      mCache.forget( options.file );
+    } else {
+      mCache.updated( options.file );
+    }
+    if( options.bReport ){
+      out.appendCopy( stats.report() );
+    }
+    return respond( true, out );
+  }
+  // the cached copy no longer matches the file.
+  mCache.forget( options.file );
+  out.appendCopy( error );
+  return respond( false, out );
+}
+
+//////////////////////////////////////////////////////////
+// parse what the client has sent, and answer each complete line.
+// false - the client has gone, or sent too long a token.
+bool ConfigServer::readClient( Client & client )
+{
+  char block[ 65536 ];
+  ssize_t got = read( client.mFd, block, sizeof( block ) );
+  if( got < 0 && errno == EINTR ){
+    return true;
+  }
+  if( got <= 0 ){
+    return false;
+  }
+  const char * pos = block;
+  const char * end = block + got;
+  while( pos != end ){
+    const char * eol = (const char *)memchr( pos, '\n', end - pos );
+    client.mParser.feed( pos, ( eol ? eol : end ) - pos );
+    if( eol == nullptr ) break;
+    pos = eol + 1;
+    if( client.mParser.started() ){
+      bool parsed = client.mParser.finish();
+      if( request( client.mFd, parsed, client.mHandler ) == false ){
+	return false;
+      }
+    }
+    client.mParser.reset();
+    client.mHandler.reset();
+  }
+  return client.mParser.pending() < RequestHandler::maxRequest;
+}
+
+void ConfigServer::run()
+{
+  std::vector< struct pollfd > fds;
+  while( true ){
+    fds.clear();
+    fds.push_back( pollfd{ mWake[0], POLLIN, 0 } );
+    fds.push_back( pollfd{ mListen, POLLIN, 0 } );
+    for( auto it = mClients.begin(); it != mClients.end(); it++ ){
+      fds.push_back( pollfd{ (*it)->mFd, POLLIN, 0 } );
+    }
+    if( poll( fds.data(), fds.size(), -1 ) < 0 ){
+      if( errno == EINTR ) continue;
+      std::cerr << "poll failed - " << strerror( errno ) << std::endl;
+      return;
+    }
+    if( fds[0].revents ){
+      return;
+    }
+    for( size_t i = mClients.size(); i > 0; i-- ){
+      if( fds[ i + 1 ].revents == 0 ) continue;
+      if( readClient( *mClients[ i - 1 ] ) == false ){
+	close( mClients[ i - 1 ]->mFd );
+	mClients.erase( mClients.begin() + ( i - 1 ) );
+      }
+    }
+    if( fds[1].revents & POLLIN ){
+      int fd = accept4( mListen, nullptr, nullptr, SOCK_CLOEXEC );
+      if( fd >= 0 ){
+	// a client which stops reading is dropped, rather than
+	// blocking every other client.
+	struct timeval timeout = { sendTimeout, 0 };
+	setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof( timeout ) );
+	mClients.emplace_back( new Client( fd ) );
+      }
+    }
+  }
+}
+
+void ConfigServer::stop()
+{
+  char ch = 0;
+  if( write( mWake[1], &ch, 1 ) < 0 ){
+    // already woken
+  }
+}
+
+static int gWakeFd = -1;
+static void onSignal( int )
+{
+  char ch = 0;
+  if( write( gWakeFd, &ch, 1 ) < 0 ){
+    // nothing can be done in a signal handler
+  }
+}
+
+bool runServer( const ConfigSetup & cfg, const std::string & socketPath )
+{
+  ConfigServer server( cfg );
+  std::string error;
+  if( server.open( socketPath, error ) == false ){
+    std::cerr << error << std::endl;
+    return false;
+  }
+  signal( SIGPIPE, SIG_IGN );
+  struct sigaction sa;
+  memset( &sa, 0, sizeof( sa ) );
+  sa.sa_handler = onSignal;
+  sigemptyset( &sa.sa_mask );
+  sigaction( SIGINT, &sa, nullptr );
+  sigaction( SIGTERM, &sa, nullptr );
+  gWakeFd = server.wakeFd();
+  server.run();
+  return true;
+}
@@ -0,0 +1,132 @@
+//////////////////////////////////////////////////////////
+//  config_server - config_edit as a resident process.
+//
+//  Listens on a unix domain socket.  Each request is one line
+//  holding a json array of the same arguments as the command line
+//  e.g.
+//    ["config_edit", "--platform", "pi4", "--add", "dtoverlay=vc4"]
+//  and is answered with
+//    ok <length>\n<length bytes of output>
+//    error <length>\n<length bytes of message>
+//  The schema is built once, and each file is parsed once and kept
+//  in a ConfigCache, so a request only costs the edit itself.
+#pragma once
+#if ! defined( H_CONFIG_SERVER_H)
+#define H_CONFIG_SERVER_H
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <sys/types.h>
+#include "config_edit.h"
+
+//////////////////////////////////////////////////////////
+// ConfigCache - parsed files, by name.
+// An entry is used while the file's inode, size and mtime are
+// unchanged.  mtime may be as coarse as 2 seconds (FAT), so an
+// entry which was loaded within that window of its mtime also has
+// its content hash checked.
+class ConfigCache
+{
+  struct Entry {
+    WholeFile mFile;
+    dev_t mDev;
+    ino_t mIno;
+    off_t mSize;
+    struct timespec mMtime;
+    uint64_t mHash;
+    time_t mVerifiedAt;
+  };
+  const ConfigSetup & mConfig;
+  std::map< std::string, Entry > mEntries;
+  bool load( const std::string & fileName, Entry & entry,
+	     std::string & error );
+public:
+  size_t mHits;
+  size_t mReloads;
+  ConfigCache( const ConfigSetup & config )
+    : mConfig( config )
+    , mHits( 0 )
+    , mReloads( 0 )
+  {}
+  // the current contents of fileName, or nullptr with error set.
+  WholeFile * get( const std::string & fileName, std::string & error );
+  // the cached WholeFile has been written to fileName.
+  void updated( const std::string & fileName );
+  void forget( const std::string & fileName );
+};
+
+//////////////////////////////////////////////////////////
+// the request - a json array of strings.
+class RequestHandler : public json_lite::ReaderHandlerAllFail
+{
+  int mDepth;
+  size_t mBytes;  // of mArgs, limited to maxRequest
+public:
+  // the most a client may send as one request.
+  static const size_t maxRequest = 1024 * 1024;
+  std::vector< std::string > mArgs;
+  RequestHandler()
+    : mDepth( 0 )
+    , mBytes( 0 )
+  {}
+  void reset()
+  {
+    mDepth = 0;
+    mBytes = 0;
+    mArgs.clear();
+    mError = false;
+    mErrorMessage.clear();
+  }
+  bool StartArray();
+  bool EndArray();
+  bool String( const char * str, size_t len );
+};
+
+class ConfigServer
+{
+  // each client's request is parsed as it arrives, so only a
+  // token split between reads is buffered.
+  struct Client {
+    int mFd;
+    RequestHandler mHandler;
+    json_lite::PushParser mParser;
+    Client( int fd )
+      : mFd( fd )
+      , mParser( mHandler, true )
+    {}
+  };
+  const ConfigSetup & mConfig;
+  ConfigCache mCache;
+  std::string mPath;
+  int mListen;
+  int mWake[2];
+  std::vector< std::unique_ptr< Client > > mClients;
+  bool readClient( Client & client );
+  bool respond( bool ok, GatherWriter & out );
+  // the request the handler has collected - parsed false if it
+  // wasn't a json array.
+  bool request( int fd, bool parsed, const RequestHandler & handler );
+public:
+  ConfigServer( const ConfigSetup & config );
+  ~ConfigServer();
+  bool open( const std::string & socketPath, std::string & error );
+  // handle one request line, writing the response to fd.
+  bool request( int fd, const std::string & line );
+  // serve until stop() is called.
+  void run();
+  void stop();
+  int wakeFd() const
+  {
+    return mWake[1];
+  }
+  const ConfigCache & cache() const
+  {
+    return mCache;
+  }
+};
+
+// --daemon socket - serve until SIGINT or SIGTERM.
+bool runServer( const ConfigSetup & cfg, const std::string & socketPath );
+#endif
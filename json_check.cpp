@@ -0,0 +1,462 @@
+//////////////////////////////////////////////////////////
+// json_check - differential test of the json_lite readers.
+//
+//  ./json_check [--documents n] [--seed n]
+//
+//  Generates random documents, valid and with random bytes
+//  changed, and reads each in strict and lax mode.  The Reader
+//  over a StringInputStream (a character at a time, no scan
+//  kernels) is the reference.  Against it are checked:
+//    BufferReader with each scan kernel the cpu has,
+//    PushParser given the whole text, 1 byte and random chunks,
+//    Document, for the documents the reference accepts.
+//  Each must give the same events and result.  Exits 1 on the
+//  first few mismatches, printing the document.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include "json_lite.h"
+
+//////////////////////////////////////////////////////////
+// Recorder - the events, one per line, numbers by callback
+// and exact value.
+class Recorder : public json_lite::ReaderHandler
+{
+public:
+  std::string mEvents;
+  bool Null() override
+  {
+    mEvents += "null\n";
+    return true;
+  }
+  bool Bool( bool b ) override
+  {
+    mEvents += b ? "true\n" : "false\n";
+    return true;
+  }
+  bool Int( int i ) override
+  {
+    mEvents += "int " + std::to_string( i ) + "\n";
+    return true;
+  }
+  bool Uint( unsigned u ) override
+  {
+    mEvents += "uint " + std::to_string( u ) + "\n";
+    return true;
+  }
+  bool Int64( int64_t i ) override
+  {
+    mEvents += "int64 " + std::to_string( i ) + "\n";
+    return true;
+  }
+  bool Uint64( uint64_t u ) override
+  {
+    mEvents += "uint64 " + std::to_string( u ) + "\n";
+    return true;
+  }
+  bool Double( double d ) override
+  {
+    char text[ 64 ];
+    snprintf( text, sizeof( text ), "double %a\n", d );
+    mEvents += text;
+    return true;
+  }
+  bool String( const char * str, size_t size ) override
+  {
+    mEvents += "string " + std::string( str, size ) + "\n";
+    return true;
+  }
+  bool RawNumber( const char *, size_t ) override
+  {
+    return true;
+  }
+  bool StartObject() override
+  {
+    mEvents += "{\n";
+    return true;
+  }
+  bool Key( const char * str, size_t length ) override
+  {
+    mEvents += "key " + std::string( str, length ) + "\n";
+    return true;
+  }
+  bool EndObject() override
+  {
+    mEvents += "}\n";
+    return true;
+  }
+  bool StartArray() override
+  {
+    mEvents += "[\n";
+    return true;
+  }
+  bool EndArray() override
+  {
+    mEvents += "]\n";
+    return true;
+  }
+};
+
+struct Outcome
+{
+  bool mResult;
+  std::string mEvents;
+  bool operator==( const Outcome & rhs ) const
+  {
+    return mResult == rhs.mResult && mEvents == rhs.mEvents;
+  }
+};
+
+//////////////////////////////////////////////////////////
+// Generator - random json, with the escapes, unquoted symbols
+// and number forms the readers treat specially.
+class Generator
+{
+  std::mt19937_64 mRandom;
+  size_t below( size_t n )
+  {
+    return mRandom() % n;
+  }
+  void space( std::string & out )
+  {
+    static const char spaces[] = " \t\r\n";
+    size_t count = below( 4 ) == 0 ? below( 40 ) : below( 2 );
+    for( size_t i = 0; i < count; i++ ){
+      out += spaces[ below( 4 ) ];
+    }
+  }
+  void number( std::string & out )
+  {
+    static const char * const fixed[] = {
+      "0", "-0", "2147483647", "2147483648", "4294967295", "4294967296",
+      "9223372036854775807", "9223372036854775808", "18446744073709551615",
+      "18446744073709551616", "-2147483648", "-2147483649",
+      "-9223372036854775808", "-9223372036854775809", "1e308", "1e309",
+      "-1e-400", "0.1", "1E+2", "01", "1.", "1e", "-", "1-2", "2.5e-3"
+    };
+    if( below( 3 ) == 0 ){
+      out += fixed[ below( sizeof( fixed ) / sizeof( fixed[0] ) ) ];
+      return;
+    }
+    if( below( 2 ) ) out += '-';
+    out += std::to_string( mRandom() >> below( 64 ) );
+    if( below( 3 ) == 0 ){
+      out += '.';
+      out += std::to_string( below( 100000 ) );
+    }
+    if( below( 4 ) == 0 ){
+      out += "eE"[ below( 2 ) ];
+      if( below( 2 ) ) out += "+-"[ below( 2 ) ];
+      out += std::to_string( below( 400 ) );
+    }
+  }
+  void string( std::string & out, bool lax )
+  {
+    static const char * const escapes[] = {
+      "\\\"", "\\\\", "\\/", "\\b", "\\f", "\\n", "\\r", "\\t",
+      "\\u0041", "\\u00e9", "\\u20ac", "\\ud83d\\ude00", "\\ud800",
+      "\\u12", "\\00e9", "\\x", "\\"
+    };
+    if( lax && below( 4 ) == 0 ){
+      static const char * const symbols[] = {
+	"true", "false", "null", "word", "gpio4", "tru"
+      };
+      out += symbols[ below( sizeof( symbols ) / sizeof( symbols[0] ) ) ];
+      return;
+    }
+    out += '"';
+    size_t length = below( 8 ) == 0 ? below( 200 ) : below( 12 );
+    for( size_t i = 0; i < length; i++ ){
+      size_t kind = below( 20 );
+      if( kind == 0 ){
+	out += escapes[ below( sizeof( escapes ) / sizeof( escapes[0] ) ) ];
+      } else if( kind == 1 ){
+	out += char( 0x80 + below( 0x80 ) );
+      } else if( kind == 2 && below( 10 ) == 0 ){
+	out += char( 1 + below( 31 ) );
+      } else {
+	out += char( ' ' + below( 95 ) );
+	if( out.back() == '"' || out.back() == '\\' ) out.back() = 'q';
+      }
+    }
+    out += '"';
+  }
+  void value( std::string & out, bool lax, size_t depth )
+  {
+    space( out );
+    size_t kind = below( depth > 6 ? 4 : 7 );
+    switch( kind ){
+    case 0:
+      number( out );
+      break;
+    case 1:
+      string( out, lax );
+      break;
+    case 2:
+      out += below( 2 ) ? "true" : below( 2 ) ? "false" : "null";
+      break;
+    case 3:
+      string( out, false );
+      break;
+    case 4:
+    case 5:
+      {
+	out += '[';
+	size_t count = below( 6 );
+	for( size_t i = 0; i < count; i++ ){
+	  if( i ) out += ',';
+	  value( out, lax, depth + 1 );
+	}
+	space( out );
+	out += ']';
+	break;
+      }
+    default:
+      {
+	out += '{';
+	size_t count = below( 6 );
+	for( size_t i = 0; i < count; i++ ){
+	  if( i ) out += ',';
+	  space( out );
+	  string( out, lax );
+	  space( out );
+	  out += ':';
+	  value( out, lax, depth + 1 );
+	}
+	space( out );
+	out += '}';
+	break;
+      }
+    }
+    space( out );
+  }
+public:
+  Generator( uint64_t seed )
+    : mRandom( seed )
+  {}
+  // a document, with some bytes changed when broken.
+  std::string document( bool lax, bool broken )
+  {
+    std::string out;
+    value( out, lax, 0 );
+    size_t changes = broken ? 1 + below( 3 ) : 0;
+    for( size_t i = 0; i < changes && out.size(); i++ ){
+      static const char tokens[] = "{}[]:,\"\\ -01eE.tfn";
+      size_t pos = below( out.size() );
+      char ch = tokens[ below( sizeof( tokens ) - 1 ) ];
+      switch( below( 3 ) ){
+      case 0:
+	out.erase( pos, 1 );
+	break;
+      case 1:
+	out.insert( pos, 1, ch );
+	break;
+      default:
+	out[ pos ] = ch;
+	break;
+      }
+    }
+    return out;
+  }
+  size_t chunk( size_t left )
+  {
+    return 1 + below( std::min< size_t >( left, 64 ) );
+  }
+};
+
+static Outcome readStream( const std::string & text, bool strict )
+{
+  Recorder events;
+  json_lite::StringInputStream stream( text.c_str() );
+  json_lite::Reader rdr( events, stream, strict );
+  bool result = rdr.read( strict );
+  return Outcome{ result, events.mEvents };
+}
+
+static Outcome readBuffer( const std::string & text, bool strict,
+			   const json_lite::scan::Kernels & kernels )
+{
+  Recorder events;
+  json_lite::BufferInputStream stream( text );
+  json_lite::BufferReader rdr( events, stream, strict );
+  rdr.useKernels( kernels );
+  bool result = rdr.read( strict );
+  return Outcome{ result, events.mEvents };
+}
+
+// chunk - 0 the whole text, otherwise the size of each chunk, or
+// random sizes when chunks is given.
+static Outcome readPushed( const std::string & text, bool strict,
+			   size_t chunk, Generator * chunks )
+{
+  Recorder events;
+  json_lite::PushParser parser( events, strict );
+  size_t pos = 0;
+  while( pos < text.size() ){
+    size_t length = chunks ? chunks->chunk( text.size() - pos )
+      : chunk ? std::min( chunk, text.size() - pos ) : text.size();
+    parser.feed( text.data() + pos, length );
+    pos += length;
+  }
+  bool result = parser.finish();
+  return Outcome{ result, events.mEvents };
+}
+
+// value's events, as the reader would have sent them.
+static void replay( const json_lite::Value & value,
+		    json_lite::ReaderHandler & events )
+{
+  switch( value.type() ){
+  case json_lite::Value::vtNull:
+    events.Null();
+    break;
+  case json_lite::Value::vtBool:
+    events.Bool( value.asBool() );
+    break;
+  case json_lite::Value::vtInt:
+    events.Int64( value.asInt64() );
+    break;
+  case json_lite::Value::vtUint:
+    events.Uint64( value.asUint64() );
+    break;
+  case json_lite::Value::vtDouble:
+    events.Double( value.asDouble() );
+    break;
+  case json_lite::Value::vtString:
+    events.String( value.asString().data(), value.asString().size() );
+    break;
+  case json_lite::Value::vtArray:
+    events.StartArray();
+    for( size_t i = 0; i < value.size(); i++ ){
+      replay( value[ i ], events );
+    }
+    events.EndArray();
+    break;
+  case json_lite::Value::vtObject:
+    events.StartObject();
+    for( size_t i = 0; i < value.size(); i++ ){
+      const json_lite::Member & member = value.member( i );
+      events.Key( member.mKey.data(), member.mKey.size() );
+      replay( member.mValue, events );
+    }
+    events.EndObject();
+    break;
+  }
+}
+
+// the document as json_lite::Writer text - the Document keeps
+// 64 bit numbers, so the callbacks can't be compared.
+static bool writeDocument( const std::string & text, std::string & out )
+{
+  json_lite::Document document;
+  if( document.parse( text ) == false ){
+    return false;
+  }
+  json_lite::Writer writer( out );
+  replay( document.root(), writer );
+  return true;
+}
+
+static std::string writeStream( const std::string & text )
+{
+  std::string out;
+  json_lite::Writer writer( out );
+  json_lite::StringInputStream stream( text.c_str() );
+  json_lite::Reader rdr( writer, stream, true );
+  rdr.read( true );
+  return out;
+}
+
+static size_t gFailures = 0;
+
+static void mismatch( const char * reader, const std::string & text,
+		      bool strict, const Outcome & expected,
+		      const Outcome & got )
+{
+  if( gFailures++ >= 5 ) return;
+  printf( "mismatch: %s (%s)\n", reader, strict ? "strict" : "lax" );
+  printf( "document: " );
+  for( size_t i = 0; i < text.size(); i++ ){
+    unsigned char ch = text[i];
+    if( ch < ' ' || ch >= 0x7f || ch == '\\' ){
+      printf( "\\x%02x", ch );
+    } else {
+      putchar( ch );
+    }
+  }
+  printf( "\nexpected %s:\n%sgot %s:\n%s\n",
+	  expected.mResult ? "true" : "false", expected.mEvents.c_str(),
+	  got.mResult ? "true" : "false", got.mEvents.c_str() );
+}
+
+int main( int argc, char * argv[] )
+{
+  size_t documents = 20000;
+  uint64_t seed = 1;
+  static struct option options[] = {
+    { "documents", required_argument, nullptr, 'n' },
+    { "seed",      required_argument, nullptr, 's' },
+    { nullptr,     0,                 nullptr, 0 },
+  };
+  int c;
+  while( ( c = getopt_long( argc, argv, "n:s:", options, nullptr ) ) != -1 ){
+    switch( c ){
+    case 'n':
+      documents = strtoul( optarg, nullptr, 10 );
+      break;
+    case 's':
+      seed = strtoull( optarg, nullptr, 10 );
+      break;
+    default:
+      fprintf( stderr, "usage: %s [--documents n] [--seed n]\n", argv[0] );
+      return 2;
+    }
+  }
+  Generator generate( seed );
+  auto kernels = json_lite::scan::availableKernels();
+  size_t accepted = 0;
+  for( size_t d = 0; d < documents; d++ ){
+    bool lax = d % 4 == 3;
+    std::string text = generate.document( lax, d % 2 == 1 );
+    for( int strict = 0; strict < 2; strict++ ){
+      Outcome expected = readStream( text, strict );
+      accepted += expected.mResult;
+      for( auto k = kernels.begin(); k != kernels.end(); k++ ){
+	Outcome got = readBuffer( text, strict, **k );
+	if( !( got == expected ) ){
+	  mismatch( ( std::string( "BufferReader " ) + (*k)->mName ).c_str(),
+		    text, strict, expected, got );
+	}
+      }
+      static const size_t chunks[] = { 0, 1 };
+      for( size_t chunk : chunks ){
+	Outcome got = readPushed( text, strict, chunk, nullptr );
+	if( !( got == expected ) ){
+	  mismatch( chunk ? "PushParser 1 byte" : "PushParser whole",
+		    text, strict, expected, got );
+	}
+      }
+      Outcome got = readPushed( text, strict, 0, &generate );
+      if( !( got == expected ) ){
+	mismatch( "PushParser random chunks", text, strict, expected, got );
+      }
+      // a first token the reader rejects leaves nothing open, so is
+      // accepted as no document - and the Document's root is null.
+      if( strict && expected.mResult && expected.mEvents.size() ){
+	Outcome written{ true, std::string() };
+	written.mResult = writeDocument( text, written.mEvents );
+	Outcome reference{ true, writeStream( text ) };
+	if( !( written == reference ) ){
+	  mismatch( "Document", text, strict, reference, written );
+	}
+      }
+    }
+  }
+  printf( "json_check: %zu documents, %zu reads accepted, %zu kernels, "
+	  "%zu mismatches\n", documents, accepted, kernels.size(), gFailures );
+  return gFailures ? 1 : 0;
+}
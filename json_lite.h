@@ -4,10 +4,23 @@
 #if ! defined( H_JSON_LITE_H)
 #define H_JSON_LITE_H
 #include <cctype>
+#include <charconv>
+#include <climits>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string.h>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <algorithm>
+#include <type_traits>
 #include <assert.h>
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define JSON_LITE_X86
+#endif
 
 namespace json_lite {
   // parser based on grammar
@@ -29,6 +42,11 @@ namespace json_lite {
     virtual bool EndObject() = 0;
     virtual bool StartArray() = 0;
     virtual bool EndArray() = 0;
+    // RawNumber is only called for handlers which return true.
+    virtual bool wantsRawNumber() const
+    {
+      return false;
+    }
   };
 
   class InputStream
@@ -74,15 +92,265 @@ namespace json_lite {
     }
   };
 
+  //////////////////////////////////////////////////////////
+  // BufferInputStream - a contiguous buffer (string, mmapped
+  // file...), not necessarily null terminated.
+  // final, so a ReaderT< BufferInputStream > calls getch and
+  // ungetch directly, and they inline to pointer arithmetic;
+  // through an InputStream & it is an ordinary stream.
+  class BufferInputStream final : public InputStream
+  {
+    const char * mBegin;
+    const char * mPos;
+    const char * mEnd;
+  public:
+    BufferInputStream( const char * data, size_t length )
+      : mBegin( data )
+      , mPos( data )
+      , mEnd( data + length )
+    {}
+    BufferInputStream( std::string_view data )
+      : BufferInputStream( data.data(), data.size() )
+    {}
+    bool getch( char & ch ) override
+    {
+      if( mPos == mEnd ){
+	return false;
+      }
+      ch = *mPos++;
+      return true;
+    }
+    // only ever the character just read.
+    bool ungetch( const char ) override
+    {
+      if( mPos == mBegin ){
+	return false;
+      }
+      mPos--;
+      return true;
+    }
+    const char * position() const
+    {
+      return mPos;
+    }
+    const char * end() const
+    {
+      return mEnd;
+    }
+    void seek( const char * pos )
+    {
+      mPos = pos;
+    }
+  };
+
+  template< class Stream >
+  struct isContiguous : std::false_type {};
+  template<>
+  struct isContiguous< BufferInputStream > : std::true_type {};
+
+  //////////////////////////////////////////////////////////
+  // character classes, as isspace etc. in the C locale.
+  enum CharClass { ccSpace = 1, ccToken = 2, ccControl = 4,
+		   ccDigit = 8, ccHex = 16, ccNumber = 32 };
+  struct CharTable
+  {
+    unsigned char mClass[256];
+    constexpr CharTable()
+      : mClass{}
+    {
+      for( int ch = 0; ch < 256; ch++ ){
+	unsigned char cls = 0;
+	if( ch == ' ' || ( ch >= '\t' && ch <= '\r' ) ) cls |= ccSpace;
+	if( ch == '[' || ch == ']' || ch == '{' || ch == '}' ||
+	    ch == ',' || ch == ':' ) cls |= ccToken;
+	if( ch < 0x20 || ch == 0x7f ) cls |= ccControl;
+	if( ch >= '0' && ch <= '9' ) cls |= ccDigit | ccHex;
+	if( ( ch >= 'a' && ch <= 'f' ) || ( ch >= 'A' && ch <= 'F' ) ) cls |= ccHex;
+	if( ( ch >= '0' && ch <= '9' ) || ch == '-' || ch == '+' ||
+	    ch == '.' || ch == 'e' || ch == 'E' ) cls |= ccNumber;
+	mClass[ ch ] = cls;
+      }
+    }
+  };
+  inline constexpr CharTable charTable;
+  inline bool isClass( char ch, unsigned cls )
+  {
+    return ( charTable.mClass[ (unsigned char)ch ] & cls ) != 0;
+  }
+  // ch is ccHex
+  inline int hexDigit( char ch )
+  {
+    return ch <= '9' ? ch - '0' : ( ch | 0x20 ) - 'a' + 10;
+  }
+
+  //////////////////////////////////////////////////////////
+  // isNumber - text is exactly a json number
+  // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+  inline bool isNumber( std::string_view text, bool & isInteger )
+  {
+    const char * pos = text.data();
+    const char * end = pos + text.size();
+    auto digits = [&pos, end]() {
+      const char * start = pos;
+      while( pos != end && isClass( *pos, ccDigit ) ) pos++;
+      return pos != start;
+    };
+    isInteger = true;
+    if( pos != end && *pos == '-' ) pos++;
+    if( pos != end && *pos == '0' ){
+      pos++;
+    } else if( digits() == false ){
+      return false;
+    }
+    if( pos != end && *pos == '.' ){
+      pos++;
+      isInteger = false;
+      if( digits() == false ) return false;
+    }
+    if( pos != end && ( *pos == 'e' || *pos == 'E' ) ){
+      pos++;
+      isInteger = false;
+      if( pos != end && ( *pos == '+' || *pos == '-' ) ) pos++;
+      if( digits() == false ) return false;
+    }
+    return pos == end;
+  }
+
+  //////////////////////////////////////////////////////////
+  // scan - find the end of runs in a buffer, 16 or 32 bytes at
+  // a time where the cpu allows.
+  // skipWhitespace - the first non whitespace character.
+  // stringEnd - the first '"', '\\' or control character.
+  // Both return end if there is none.
+  namespace scan {
+    typedef const char * (*ScanFn)( const char * pos, const char * end );
+    struct Kernels {
+      const char * mName;
+      ScanFn skipWhitespace;
+      ScanFn stringEnd;
+    };
+
+    inline const char * skipWhitespaceScalar( const char * pos, const char * end )
+    {
+      while( pos != end && isClass( *pos, ccSpace ) ) pos++;
+      return pos;
+    }
+    inline const char * stringEndScalar( const char * pos, const char * end )
+    {
+      while( pos != end && *pos != '"' && *pos != '\\' &&
+	     isClass( *pos, ccControl ) == false ) pos++;
+      return pos;
+    }
+#if defined( JSON_LITE_X86 )
+    // x - 9 <= 4 unsigned, i.e. '\t' ... '\r'
+    __attribute__(( target( "sse2" ) ))
+    inline const char * skipWhitespaceSse2( const char * pos, const char * end )
+    {
+      const __m128i space = _mm_set1_epi8( ' ' );
+      const __m128i tab = _mm_set1_epi8( '\t' );
+      const __m128i four = _mm_set1_epi8( 4 );
+      for( ; end - pos >= 16; pos += 16 ){
+	__m128i x = _mm_loadu_si128( (const __m128i *)pos );
+	__m128i t = _mm_sub_epi8( x, tab );
+	__m128i ws = _mm_or_si128( _mm_cmpeq_epi8( x, space ),
+				   _mm_cmpeq_epi8( _mm_min_epu8( t, four ), t ) );
+	unsigned mask = ~_mm_movemask_epi8( ws ) & 0xffff;
+	if( mask ) return pos + __builtin_ctz( mask );
+      }
+      return skipWhitespaceScalar( pos, end );
+    }
+    __attribute__(( target( "sse2" ) ))
+    inline const char * stringEndSse2( const char * pos, const char * end )
+    {
+      const __m128i quote = _mm_set1_epi8( '"' );
+      const __m128i backslash = _mm_set1_epi8( '\\' );
+      const __m128i del = _mm_set1_epi8( 0x7f );
+      const __m128i lastControl = _mm_set1_epi8( 0x1f );
+      for( ; end - pos >= 16; pos += 16 ){
+	__m128i x = _mm_loadu_si128( (const __m128i *)pos );
+	__m128i hit = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( x, quote ),
+						  _mm_cmpeq_epi8( x, backslash ) ),
+				    _mm_or_si128( _mm_cmpeq_epi8( x, del ),
+						  _mm_cmpeq_epi8( _mm_min_epu8( x, lastControl ), x ) ) );
+	unsigned mask = _mm_movemask_epi8( hit );
+	if( mask ) return pos + __builtin_ctz( mask );
+      }
+      return stringEndScalar( pos, end );
+    }
+    __attribute__(( target( "avx2" ) ))
+    inline const char * skipWhitespaceAvx2( const char * pos, const char * end )
+    {
+      const __m256i space = _mm256_set1_epi8( ' ' );
+      const __m256i tab = _mm256_set1_epi8( '\t' );
+      const __m256i four = _mm256_set1_epi8( 4 );
+      for( ; end - pos >= 32; pos += 32 ){
+	__m256i x = _mm256_loadu_si256( (const __m256i *)pos );
+	__m256i t = _mm256_sub_epi8( x, tab );
+	__m256i ws = _mm256_or_si256( _mm256_cmpeq_epi8( x, space ),
+				      _mm256_cmpeq_epi8( _mm256_min_epu8( t, four ), t ) );
+	unsigned mask = ~(unsigned)_mm256_movemask_epi8( ws );
+	if( mask ) return pos + __builtin_ctz( mask );
+      }
+      return skipWhitespaceScalar( pos, end );
+    }
+    __attribute__(( target( "avx2" ) ))
+    inline const char * stringEndAvx2( const char * pos, const char * end )
+    {
+      const __m256i quote = _mm256_set1_epi8( '"' );
+      const __m256i backslash = _mm256_set1_epi8( '\\' );
+      const __m256i del = _mm256_set1_epi8( 0x7f );
+      const __m256i lastControl = _mm256_set1_epi8( 0x1f );
+      for( ; end - pos >= 32; pos += 32 ){
+	__m256i x = _mm256_loadu_si256( (const __m256i *)pos );
+	__m256i hit = _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi8( x, quote ),
+							_mm256_cmpeq_epi8( x, backslash ) ),
+				       _mm256_or_si256( _mm256_cmpeq_epi8( x, del ),
+							_mm256_cmpeq_epi8( _mm256_min_epu8( x, lastControl ), x ) ) );
+	unsigned mask = _mm256_movemask_epi8( hit );
+	if( mask ) return pos + __builtin_ctz( mask );
+      }
+      return stringEndScalar( pos, end );
+    }
+#endif
+    inline const Kernels & scalarKernels()
+    {
+      static const Kernels kernels{ "scalar", skipWhitespaceScalar, stringEndScalar };
+      return kernels;
+    }
+    // the kernels available on this cpu, best last.
+    inline std::vector< const Kernels * > availableKernels()
+    {
+      std::vector< const Kernels * > all{ &scalarKernels() };
+#if defined( JSON_LITE_X86 )
+      static const Kernels sse2{ "sse2", skipWhitespaceSse2, stringEndSse2 };
+      static const Kernels avx2{ "avx2", skipWhitespaceAvx2, stringEndAvx2 };
+      __builtin_cpu_init();
+      if( __builtin_cpu_supports( "sse2" ) ) all.push_back( &sse2 );
+      if( __builtin_cpu_supports( "avx2" ) ) all.push_back( &avx2 );
+#endif
+      return all;
+    }
+    inline const Kernels & bestKernels()
+    {
+      static const Kernels * best = availableKernels().back();
+      return *best;
+    }
+  }
+
   class Token
   {
   public:
     enum TokenType { tkNull, tkTrue, tkFalse, tkString, tkNumber, tkStartObject, tkEndObject, tkStartArray, tkEndArray, tkComma, tkColon };
   private:
-    std::string mValue;
+    // the text of a string or number - a view of the input, or of
+    // the reader's scratch buffer, valid until the next token.
+    std::string_view mValue;
     TokenType   mToken;
   public:
-    bool symbol( const std::string & str ) 
+    Token()
+      : mToken( tkNull )
+    {}
+    bool symbol( std::string_view str )
     {
       if( str == "true" ){
 	mToken = tkTrue;
@@ -98,9 +366,9 @@ namespace json_lite {
       }
       return false;
     }
-    bool isValue()
+    static constexpr bool isValue( TokenType token )
     {
-      switch( mToken ){
+      switch( token ){
       default:
 	return false;
       case  tkNull: case tkTrue: case tkFalse:
@@ -109,6 +377,10 @@ namespace json_lite {
 	return true;
       }
     }
+    bool isValue() const
+    {
+      return isValue( mToken );
+    }
     bool sym( const char sym )
     {
       switch( sym ){
@@ -135,15 +407,21 @@ namespace json_lite {
       }
       return false;
     }
-    Token & operator=( const std::string & rhs )
+    Token & operator=( std::string_view rhs )
     {
       mValue = rhs;
       mToken = tkString;
       return *this;
     }
+    void number( std::string_view text )
+    {
+      mValue = text;
+      mToken = tkNumber;
+    }
+    // not null terminated.
     const char * str() const
     {
-      return mValue.c_str();
+      return mValue.data();
     }
     size_t len() const
     {
@@ -155,12 +433,13 @@ namespace json_lite {
     }
   };
 
-  class Reader
-  {
-    size_t mObjectDepth;
-    ReaderHandler & mEvents;
-    InputStream   & mInput;
-    bool            mStrict; /* Require "round keys? */
+  //////////////////////////////////////////////////////////
+  // grammar - the reader's state machine as constexpr tables.
+  // mAllowed[ mode ] - a bit per token type which may come next.
+  // mNext[ mode ][ token ] - the mode after token.  After the end
+  // of an object or array it is applied to the mode the object or
+  // array started in.
+  namespace grammar {
     enum ReaderMode {  inObject,
 		       inObjectGotKey,
 		       inObjectGotColon,
@@ -171,27 +450,296 @@ namespace json_lite {
 		       inArray,
 		       inArrayGotValue,
 		       inArrayGotComma,
-		     
+
 		       topValue,
 
-		       done};
+		       done,
+		       modeCount };
+    enum { tokenCount = Token::tkColon + 1 };
+
+    constexpr unsigned tokenBit( Token::TokenType token )
+    {
+      return 1u << token;
+    }
+    constexpr unsigned valueTokens =
+      tokenBit( Token::tkNull ) | tokenBit( Token::tkTrue ) |
+      tokenBit( Token::tkFalse ) | tokenBit( Token::tkString ) |
+      tokenBit( Token::tkNumber ) | tokenBit( Token::tkStartObject ) |
+      tokenBit( Token::tkStartArray );
+
+    constexpr unsigned allowed( ReaderMode mode )
+    {
+      switch( mode ){
+      case topValue:
+      case inObjectGotColon:
+      case inArrayGotComma:
+	return valueTokens;
+      case inObject:
+	return tokenBit( Token::tkEndObject ) | tokenBit( Token::tkString );
+      case inObjectGotKey:
+	return tokenBit( Token::tkColon );
+      case inObjectGotValue:
+      case inObjectCommaOrEnd:
+	return tokenBit( Token::tkComma ) | tokenBit( Token::tkEndObject );
+      case inObjectGotComma:
+	return tokenBit( Token::tkString );
+      case inArray:
+	return valueTokens | tokenBit( Token::tkEndArray );
+      case inArrayGotValue:
+	return tokenBit( Token::tkComma ) | tokenBit( Token::tkEndArray );
+      default:
+	return 0;
+      }
+    }
+    constexpr ReaderMode next( ReaderMode mode, Token::TokenType token )
+    {
+      if( token == Token::tkStartObject ) return inObject;
+      if( token == Token::tkStartArray ) return inArray;
+      switch( mode ){
+      case topValue:
+	return done;
+      case inObject:
+      case inObjectGotComma:
+	return token == Token::tkString ? inObjectGotKey : mode;
+      case inObjectGotKey:
+	return inObjectGotColon;
+      case inObjectGotValue:
+      case inObjectGotColon:
+	return inObjectCommaOrEnd;
+      case inObjectCommaOrEnd:
+	return token == Token::tkComma ? inObjectGotComma : mode;
+      case inArray:
+      case inArrayGotComma:
+	// a closed object or array is a value of the array.
+	return Token::isValue( token ) || token == Token::tkEndObject ||
+	  token == Token::tkEndArray ? inArrayGotValue : mode;
+      case inArrayGotValue:
+	return token != Token::tkEndArray ? inArrayGotComma : mode;
+      default:
+	return mode;
+      }
+    }
+
+    struct Table
+    {
+      unsigned mAllowed[ modeCount ];
+      unsigned char mNext[ modeCount ][ tokenCount ];
+      constexpr Table()
+	: mAllowed{}
+	, mNext{}
+      {
+	for( int mode = 0; mode < modeCount; mode++ ){
+	  mAllowed[ mode ] = allowed( ReaderMode( mode ) );
+	  for( int token = 0; token < tokenCount; token++ ){
+	    mNext[ mode ][ token ] = next( ReaderMode( mode ),
+					   Token::TokenType( token ) );
+	  }
+	}
+      }
+    };
+    inline constexpr Table table;
+  }
+
+  //////////////////////////////////////////////////////////
+  // Dispatcher - where a document is in the grammar, sending the
+  // handler the events for each token.  Shared by ReaderT, which
+  // pulls tokens from a stream, and PushParser, which is given
+  // them a chunk at a time.
+  class Dispatcher
+  {
+    enum ComplexType { ctObject, ctArray };
+    struct ReaderStack {
+      grammar::ReaderMode mMode;
+      ComplexType mType;
+    };
+    ReaderHandler & mEvents;
+    bool mRawNumbers;
+    std::vector< ReaderStack > mModeStack;
+    grammar::ReaderMode mMode;
+  public:
+    Dispatcher( ReaderHandler & events )
+      : mEvents( events )
+      , mRawNumbers( events.wantsRawNumber() )
+      , mMode( grammar::topValue )
+    {}
+    void reset()
+    {
+      mModeStack.clear();
+      mMode = grammar::topValue;
+    }
+    // grammar::tokenBit of each token type which may come next.
+    unsigned allowed() const
+    {
+      return grammar::table.mAllowed[ mMode ];
+    }
+    // no object or array is open.
+    bool complete() const
+    {
+      return mModeStack.size() == 0;
+    }
+    // the top level value has been read.
+    bool done() const
+    {
+      return mMode == grammar::done;
+    }
+    // an allowed token - false if it closes the wrong kind of
+    // object or array.
+    bool token( const Token & currentToken )
+    {
+      using namespace grammar;
+      Token::TokenType type = currentToken.type();
+      bool startComplex;
+      if( currentToken.isValue() ){
+	if( mMode == inObject || mMode == inObjectGotComma ){
+	  mEvents.Key( currentToken.str(), currentToken.len() );
+	} else {
+	  processValue( currentToken, startComplex );
+	}
+      }
+      if( type == Token::tkStartObject || type == Token::tkStartArray ){
+	ReaderStack newElem { mMode,
+			      type == Token::tkStartObject ? ctObject : ctArray };
+	mModeStack.push_back( newElem );
+      } else if( type == Token::tkEndObject || type == Token::tkEndArray ){
+	if( mModeStack.size() == 0 ) return false;
+	ReaderStack st = *mModeStack.rbegin();
+	mModeStack.pop_back();
+	if( st.mType != ( type == Token::tkEndObject ? ctObject : ctArray ) ){
+	  return false;
+	}
+	if( type == Token::tkEndObject ){
+	  mEvents.EndObject();
+	} else {
+	  mEvents.EndArray();
+	}
+	mMode = st.mMode;
+      }
+      mMode = ReaderMode( table.mNext[ mMode ][ type ] );
+      return true;
+    }
+    //////////////////////////////////////////////////////////
+    // sendNumber - as the narrowest of Int, Uint, Int64, Uint64
+    // which holds the value exactly, otherwise Double.
+    bool sendNumber( const Token & currentToken )
+    {
+      const char * first = currentToken.str();
+      const char * last = first + currentToken.len();
+      if( mRawNumbers ){
+	mEvents.RawNumber( first, currentToken.len() );
+      }
+      bool isInteger = false;
+      isNumber( std::string_view( first, currentToken.len() ), isInteger );
+      if( isInteger ){
+	if( *first == '-' ){
+	  int64_t value;
+	  auto result = std::from_chars( first, last, value );
+	  if( result.ec == std::errc() && result.ptr == last ){
+	    if( value >= INT_MIN ){
+	      mEvents.Int( int( value ) );
+	    } else {
+	      mEvents.Int64( value );
+	    }
+	    return true;
+	  }
+	} else {
+	  uint64_t value;
+	  auto result = std::from_chars( first, last, value );
+	  if( result.ec == std::errc() && result.ptr == last ){
+	    if( value <= INT_MAX ){
+	      mEvents.Int( int( value ) );
+	    } else if( value <= UINT_MAX ){
+	      mEvents.Uint( unsigned( value ) );
+	    } else if( value <= INT64_MAX ){
+	      mEvents.Int64( int64_t( value ) );
+	    } else {
+	      mEvents.Uint64( value );
+	    }
+	    return true;
+	  }
+	}
+	// too large for 64 bits
+      }
+      double dbl;
+      auto result = std::from_chars( first, last, dbl );
+      if( result.ptr != last ){
+	return false;
+      }
+      // out of range is +-HUGE_VAL or 0, as strtod.
+      if( result.ec == std::errc::result_out_of_range ){
+	dbl = strtod( std::string( first, last ).c_str(), nullptr );
+      }
+      mEvents.Double( dbl );
+      return true;
+    }
+    bool processValue( const Token & tok, bool & complex )
+    {
+      bool bDone = false;
+      complex = false;
+      switch( tok.type() )
+	{
+	case Token::tkTrue:
+	case Token::tkFalse:
+	  mEvents.Bool( tok.type() == Token::tkTrue );
+	  bDone = true;
+	  break;
+	case Token::tkNull:
+	  mEvents.Null();
+	  bDone = true;
+	  break;
+	case Token::tkNumber:
+	  bDone = sendNumber( tok );
+	  break;
+	case Token::tkString:
+	  mEvents.String( tok.str(), tok.len() );
+	  bDone = true;
+	  break;
+	case Token::tkStartObject:
+	  mEvents.StartObject();
+	  complex = true;
+	  bDone = true;
+	  break;
+	case Token::tkStartArray:
+	  mEvents.StartArray();
+	  complex = true;
+	  bDone = true;
+	  break;
+	}
+      return bDone;
+    }
+  };
+
+  //////////////////////////////////////////////////////////
+  // ReaderT - Stream provides getch and ungetch, as InputStream.
+  // Reader reads any InputStream through virtual calls, use
+  // ReaderT< BufferInputStream > (BufferReader) when the whole
+  // text is in memory.
+  template< class Stream >
+  class ReaderT
+  {
+    size_t mObjectDepth;
+    ReaderHandler & mEvents;
+    Stream        & mInput;
+    const scan::Kernels * mScan;
+    std::string     mScratch; // token text which isn't in the input
+    bool            mStrict; /* Require "round keys? */
     bool readToken_prv( Token & token, bool isStrict )
     {
       if( readWhitespace() == false ) return false;
-      std::string tmp;
+      std::string_view tmp;
       char ch;
       if( mInput.getch( ch ) == false ) return false;
       if( isSingleCharToken( ch ) ){
 	token.sym( ch );
 	return true;
       }
-      if(  ch == '-' || isdigit( ch ) ){
+      if(  ch == '-' || isClass( ch, ccDigit ) ){
 	mInput.ungetch( ch );
-	bool result = readNumber( tmp );
-	if( result ){
-	  token = tmp;
+	std::string_view number;
+	if( readNumber( number ) == false ){
+	  return false;
 	}
-	return result;
+	token.number( number );
+	return true;
       }
       mInput.ungetch( ch );
       bool result = readString( tmp, smLax );
@@ -210,112 +758,118 @@ namespace json_lite {
     }
 
   public:
-    class Grammar
-    {
-      std::vector< Token::TokenType> mNext;
-    public:
-      Grammar()
-      {}
-      template <size_t sz>
-      Grammar( const Token::TokenType (& nextSyms)[sz] )
-      : mNext( nextSyms, nextSyms + sz )
-      {
-      }
-      bool isValid( const Token::TokenType & next ) const
-      {
-	if( std::find(mNext.begin(), mNext.end(), next) != mNext.end() ){
-	  return true;
-	}
-	return false;
-      }
-    };
     enum StrictMode { smDefault, smStrict, smLax };
-    Reader( ReaderHandler & reader, InputStream & stream, bool strict = true )
+    ReaderT( ReaderHandler & reader, Stream & stream, bool strict = true )
       : mObjectDepth(0)
       , mEvents( reader )
       , mInput( stream )
+      , mScan( &scan::bestKernels() )
+      , mStrict( strict )
+    {
+    }
+    // use particular scan kernels, rather than the best available.
+    void useKernels( const scan::Kernels & kernels )
     {
+      mScan = &kernels;
     }
     bool readWhitespace()
     {
-      char ch;
-      while( mInput.getch( ch ) == true ){
-	if( isspace( ch ) ){
-	} else {
-	  mInput.ungetch( ch );
-	  return true;
+      if constexpr( isContiguous< Stream >::value ){
+	// mostly a single space or none, before paying for a kernel.
+	const char * pos = mInput.position();
+	if( pos != mInput.end() && isClass( *pos, ccSpace ) ){
+	  mInput.seek( mScan->skipWhitespace( pos, mInput.end() ) );
 	}
+	return mInput.position() != mInput.end();
       }
-      return false;
-    }
-    bool gatherDigits( std::string & gatherer )
-    {
       char ch;
       while( mInput.getch( ch ) == true ){
-	if( isdigit( ch ) ){
-	  gatherer+= ch;
+	if( isClass( ch, ccSpace ) ){
 	} else {
 	  mInput.ungetch( ch );
 	  return true;
 	}
       }
-      return true;
+      return false;
     }
+
     bool isSingleCharToken( char ch )
     {
-      static const char * single_char_tokens = "[]{},:";
-      if( strchr( single_char_tokens, ch ) != nullptr ){
-	return true;
+      return isClass( ch, ccToken );
+    }
+    // token - the run of number characters, in place in a
+    // BufferInputStream, otherwise in mScratch.  The whole run
+    // must be a number, so 1-2 is an error rather than 1 and -2.
+    bool readNumber( std::string_view & token )
+    {
+      if constexpr( isContiguous< Stream >::value ){
+	const char * start = mInput.position();
+	const char * pos = start;
+	while( pos != mInput.end() && isClass( *pos, ccNumber ) ) pos++;
+	token = std::string_view( start, pos - start );
+	mInput.seek( pos );
+      } else {
+	mScratch.clear();
+	char ch;
+	while( mInput.getch( ch ) == true ){
+	  if( isClass( ch, ccNumber ) == false ){
+	    mInput.ungetch( ch );
+	    break;
+	  }
+	  mScratch += ch;
+	}
+	token = mScratch;
       }
-      return false;
+      bool isInteger;
+      return isNumber( token, isInteger );
     }
-    bool readNumber( std::string & token )
+    bool readHex4( unsigned & code )
     {
-      std::string gather;
       char ch;
-      char firstCh;
-      if(mInput.getch( firstCh ) == false ){
-	return false;
-      }
-      gather += firstCh;
-      if( firstCh != '0' ){ // any digits up to possible .
-	gatherDigits( gather );
-      }
-      if( mInput.getch( ch ) == false ){
-	token = gather;
-	mInput.ungetch( ch );
-	return true;
-      }
-      if( ch == '.' ){
-	gather += ch;
-	gatherDigits( gather );
-      }
-      if( mInput.getch( ch ) == false ) {
-	token = gather;
-	return true;
-      }
-      if( ch == 'E' || ch == 'e' ){
-	gather += ch;
-      }
-      if( mInput.getch( ch ) == false ) { // not allowed 1.2e
-	return false;
-      }
-      if( ch == '-' || ch == '+' ){
-	gather += ch;
+      code = 0;
+      for( size_t i = 0; i < 4; i++ ){
+	if( mInput.getch( ch ) == false || isClass( ch, ccHex ) == false ){
+	  return false;
+	}
+	code = code * 16 + hexDigit( ch );
       }
-      std::string exponent;
-
-      if( gatherDigits( exponent ) == false ){
-	return false;
+      return true;
+    }
+    // the XXXX of \uXXXX (and a following low surrogate), as utf-8.
+    bool readUnicode( std::string & gather )
+    {
+      unsigned code;
+      if( readHex4( code ) == false ) return false;
+      if( code >= 0xd800 && code < 0xdc00 ){
+	char ch;
+	unsigned low;
+	if( mInput.getch( ch ) == false || ch != '\\' ||
+	    mInput.getch( ch ) == false || ch != 'u' ||
+	    readHex4( low ) == false || low < 0xdc00 || low > 0xdfff ){
+	  return false;
+	}
+	code = 0x10000 + ( ( code - 0xd800 ) << 10 ) + ( low - 0xdc00 );
       }
-      if( exponent.length() == 0 ){
-	return false;
+      if( code < 0x80 ){
+	gather += char( code );
+      } else if( code < 0x800 ){
+	gather += char( 0xc0 | ( code >> 6 ) );
+	gather += char( 0x80 | ( code & 0x3f ) );
+      } else if( code < 0x10000 ){
+	gather += char( 0xe0 | ( code >> 12 ) );
+	gather += char( 0x80 | ( ( code >> 6 ) & 0x3f ) );
+	gather += char( 0x80 | ( code & 0x3f ) );
+      } else {
+	gather += char( 0xf0 | ( code >> 18 ) );
+	gather += char( 0x80 | ( ( code >> 12 ) & 0x3f ) );
+	gather += char( 0x80 | ( ( code >> 6 ) & 0x3f ) );
+	gather += char( 0x80 | ( code & 0x3f ) );
       }
-      gather += exponent;
-      token = gather;
       return true;
     }
-    bool readString( std::string & token, enum StrictMode strictMode = smDefault )
+    // token - a view of the input where there are no escapes to
+    // undo, otherwise of mScratch.
+    bool readString( std::string_view & token, enum StrictMode strictMode = smDefault )
     {
       bool isStrict = true;
       char entryChar;
@@ -328,13 +882,36 @@ namespace json_lite {
 	   ((strictMode == smStrict )) )){
 	return false;
       }
-      std::string gather;
+      if constexpr( isContiguous< Stream >::value ){
+	if( entryChar == '"' ){
+	  const char * run = mInput.position();
+	  const char * stop = mScan->stringEnd( run, mInput.end() );
+	  if( stop != mInput.end() && *stop == '"' ){
+	    token = std::string_view( run, stop - run );
+	    mInput.seek( stop + 1 );
+	    return true;
+	  }
+	}
+      }
+      std::string & gather = mScratch;
+      gather.clear();
       if( entryChar != '"' ){
 	isStrict = false;
 	gather = entryChar;
       }
       char ch;
-      while( mInput.getch( ch ) == true ) {
+      while( true ){
+	if constexpr( isContiguous< Stream >::value ){
+	  if( isStrict ){
+	    const char * run = mInput.position();
+	    const char * stop = mScan->stringEnd( run, mInput.end() );
+	    gather.append( run, stop - run );
+	    mInput.seek( stop );
+	  }
+	}
+	if( mInput.getch( ch ) == false ){
+	  break;
+	}
 	if( ch == '"' ){
 	  if( isStrict ) {
 	    token = gather;
@@ -346,19 +923,21 @@ namespace json_lite {
 	  if( mInput.getch( ch ) == false ){
 	    return false;
 	  }
-	  if( isxdigit( ch ) ){
-	    std::string hexValue;
-	    hexValue = ch;
+	  if( ch == 'u' ){
+	    if( readUnicode( gather ) == false ){
+	      return false;
+	    }
+	  } else if( ch != 'b' && ch != 'f' && isClass( ch, ccHex ) ){
+	    int chValue = hexDigit( ch );
 	    for( size_t i = 0; i < 3 ; i++ ){
 	      if( mInput.getch( ch ) == false ){
 		return false;
 	      }
-	      if( isxdigit( ch ) == false ){
+	      if( isClass( ch, ccHex ) == false ){
 		return false;
 	      }
-	      hexValue += ch;
+	      chValue = chValue * 16 + hexDigit( ch );
 	    }
-	    int chValue = std::stoi( hexValue, nullptr, 16 );
 	    gather += chValue;
 	  } else {
 	    switch( ch ){
@@ -374,6 +953,9 @@ namespace json_lite {
 	      gather += '/';
 	      break;
 	    case 'b':
+	      gather += '\b';
+	      break;
+	    case 'f':
 	      gather += '\f';
 	      break;
 	    case 'n':
@@ -388,17 +970,19 @@ namespace json_lite {
 	    }
 	  }
 	} else {
-	  // any codepoint except " \ or control characters
-	  if( iscntrl( ch ) ){
-	    return false;
-	  }
+	  // an unquoted string ends at whitespace, including
+	  // newline and tab, or a single character token.
 	  if( isStrict == false ){
-	    if( isspace( ch) || isSingleCharToken( ch ) ){
+	    if( isClass( ch, ccSpace | ccToken ) ){
 	      mInput.ungetch( ch );
 	      token = gather;
 	      return true;
 	    }
 	  }
+	  // any codepoint except " \ or control characters
+	  if( isClass( ch, ccControl ) ){
+	    return false;
+	  }
 	  gather += ch;
 	}
       }
@@ -409,190 +993,209 @@ namespace json_lite {
 	return true;
       }
     }
-    bool readToken( Token & token, bool isStrict, const Grammar * next )
+    // allowed - grammar::tokenBit of each token type accepted.
+    bool readToken( Token & token, bool isStrict, unsigned allowed )
     {
       Token temp;
       if( readToken_prv( temp, isStrict ) ){
-	if( next == nullptr || next->isValid( temp.type() ) ){
+	if( allowed & grammar::tokenBit( temp.type() ) ){
 	  token = temp;
 	  return true;
 	}
       }
       return false;
     }
-    bool sendNumber( const Token & currentToken )
+    bool read( bool isStrict )
     {
-      mEvents.RawNumber( currentToken.str(), currentToken.len() );
-      double dbl;
-      if( strcspn( currentToken.str(), ".eE") != currentToken.len() ){
-	if( sscanf(currentToken.str(), "%f", &dbl ) == 1 ){
-	  mEvents.Double( dbl );
-	  return true;
+      Dispatcher dispatcher( mEvents );
+      Token currentToken;
+      while( readToken( currentToken, isStrict, dispatcher.allowed() ) == true ){
+	if( dispatcher.token( currentToken ) == false ){
+	  return false;
 	}
-      } else {
-	int64_t  llInt = 0;
-	llInt = std::strtoll( currentToken.str(), nullptr, 10 );
-	mEvents.Int( llInt );
-	return true;
       }
-      return false;
+      if( mObjectDepth != 0 || dispatcher.complete() == false ){
+	return false;
+      }
+      return true;
     }
-    bool processValue( const Token & tok, bool & complex )
+  };
+  typedef ReaderT< InputStream > Reader;
+  typedef ReaderT< BufferInputStream > BufferReader;
+
+  //////////////////////////////////////////////////////////
+  // PushParser - a document given a chunk at a time, as it
+  // arrives from a pipe or socket.
+  // A token split between chunks is kept until it is complete,
+  // so memory is the longest token plus the nesting depth, not
+  // the document.  Each whole token is decoded by a BufferReader,
+  // and the events are as Reader::read's for the same text.
+  class PushParser
+  {
+    enum Lexing { lxBetween, lxString, lxNumber, lxSymbol };
+    Dispatcher mDispatcher;
+    BufferInputStream mToken;
+    BufferReader mDecoder;
+    const scan::Kernels * mScan;
+    bool mStrict;
+    Lexing mLexing;
+    bool mEscape;       // the last byte of a string was a backslash
+    std::string mPending; // the start of a token split across chunks
+    bool mStarted;
+    bool mStopped;
+    bool mResult;
+
+    // end of the current token in [pos, end), nullptr if it
+    // continues past end.
+    const char * tokenEnd( const char * pos, const char * end )
     {
-      bool bDone = false;
-      complex = false;
-      switch( tok.type() )
-	{
-	case Token::tkTrue:
-	case Token::tkFalse:
-	  mEvents.Bool( tok.type() == Token::tkTrue );
-	  bDone = true;
-	  break;
-	case Token::tkNull:
-	  mEvents.Null();
-	  bDone = true;
-	  break;
-	case Token::tkNumber:
-	  bDone = sendNumber( tok );
-	  break;
-	case Token::tkString:
-	  mEvents.String( tok.str(), tok.len() );
-	  bDone = true;
-	  break;
-	case Token::tkStartObject:
-	  mEvents.StartObject();
-	  complex = true;
-	  bDone = true;
-	  break;
-	case Token::tkStartArray:
-	  mEvents.StartArray();
-	  complex = true;
-	  bDone = true;
-	  break;
+      switch( mLexing ){
+      case lxString:
+	while( pos != end ){
+	  if( mEscape ){
+	    mEscape = false;
+	    pos++;
+	    continue;
+	  }
+	  pos = mScan->stringEnd( pos, end );
+	  if( pos == end ) break;
+	  if( *pos == '"' ) return pos + 1;
+	  // a backslash, or a control character the decoder rejects
+	  mEscape = *pos == '\\';
+	  pos++;
 	}
-      return bDone;
+	return nullptr;
+      case lxNumber:
+	while( pos != end && isClass( *pos, ccNumber ) ) pos++;
+	return pos == end ? nullptr : pos;
+      default:
+	while( pos != end && isClass( *pos, ccSpace | ccToken ) == false ) pos++;
+	return pos == end ? nullptr : pos;
+      }
     }
-    bool read( bool isStrict )
+    // the reader stops at the first bad token, and the document is
+    // good if nothing was left open; or bad if an end didn't match.
+    bool dispatch( std::string_view text )
     {
-      enum ComplexType { ctObject, ctArray };
-      struct ReaderStack {
-	ReaderMode mMode;
-	const Grammar * currentGrammar;
-	ComplexType mType;
-      };
-      std::vector< ReaderStack> modeStack;
-      ReaderMode currentMode = topValue;
-
-      static const Grammar valueGrammar ({Token::tkNull, Token::tkTrue, Token::tkFalse,
-					  Token::tkString, Token::tkNumber,
-					  Token::tkStartObject, Token::tkStartArray });
-
-      static const Grammar objectStartGrammar( {Token::tkEndObject, Token::tkString } );
-      static const Grammar objectColonGrammar( {Token::tkColon } );
-      static const Grammar objectAfterValueGrammar( {Token::tkComma, Token::tkEndObject} );
-      static const Grammar objectKeyGrammar( {Token::tkString } );
-
-      static const Grammar arrayStartGrammar( {Token::tkNull, Token::tkTrue, Token::tkFalse,
-					       Token::tkString, Token::tkNumber,
-					       Token::tkStartObject, Token::tkStartArray ,
-					       Token::tkEndArray} );
-      static const Grammar arrayAfterValueGrammar( {Token::tkComma, Token::tkEndArray} );
-      static const Grammar nothingGrammar;
-      const Grammar * currentGrammar = &valueGrammar;
-
-      Token currentToken;
-      bool startComplex;
-      while( readToken( currentToken, isStrict, currentGrammar ) == true ){
-	startComplex = false;
-
-	if( currentToken.isValue() ){
-	  if( currentMode == inObject || currentMode == inObjectGotComma ){
-	    mEvents.Key( currentToken.str(), currentToken.len() );
+      mStarted = true;
+      mToken = BufferInputStream( text );
+      Token token;
+      if( mDecoder.readToken( token, mStrict, mDispatcher.allowed() ) == false ){
+	return stop( mDispatcher.complete() );
+      }
+      if( mDispatcher.token( token ) == false ){
+	return stop( false );
+      }
+      return true;
+    }
+    bool stop( bool result )
+    {
+      mStopped = true;
+      mResult = result;
+      return false;
+    }
+  public:
+    PushParser( ReaderHandler & handler, bool strict = true )
+      : mDispatcher( handler )
+      , mToken( nullptr, 0 )
+      , mDecoder( handler, mToken, strict )
+      , mScan( &scan::bestKernels() )
+      , mStrict( strict )
+      , mLexing( lxBetween )
+      , mEscape( false )
+      , mStarted( false )
+      , mStopped( false )
+      , mResult( false )
+    {}
+    PushParser( const PushParser & ) = delete;
+    PushParser & operator=( const PushParser & ) = delete;
+    // ready for another document.
+    void reset()
+    {
+      mDispatcher.reset();
+      mLexing = lxBetween;
+      mEscape = false;
+      mPending.clear();
+      mStarted = mStopped = mResult = false;
+    }
+    // false once the document has stopped at a bad token, when
+    // the rest of the input is ignored.
+    bool feed( const char * data, size_t length )
+    {
+      const char * pos = data;
+      const char * end = data + length;
+      while( mStopped == false && pos != end ){
+	const char * start = pos;
+	if( mLexing == lxBetween ){
+	  pos = mScan->skipWhitespace( pos, end );
+	  if( pos == end ) break;
+	  char ch = *pos;
+	  start = pos++;
+	  if( isClass( ch, ccToken ) ){
+	    dispatch( std::string_view( start, 1 ) );
+	    continue;
+	  }
+	  mEscape = false;
+	  if( ch == '"' ){
+	    mLexing = lxString;
+	  } else if( ch == '-' || isClass( ch, ccDigit ) ){
+	    mLexing = lxNumber;
 	  } else {
-	    processValue( currentToken, startComplex );
+	    mLexing = lxSymbol;
 	  }
 	}
-	if( currentToken.type() == Token::tkStartObject ){
-	  ReaderStack newElem { currentMode, currentGrammar, ctObject };
-	  modeStack.push_back( newElem );
-	  currentMode = inObject;
-	  currentGrammar = &objectStartGrammar;
-	} else if( currentToken.type() == Token::tkStartArray ){
-	  ReaderStack newElem { currentMode, currentGrammar, ctArray };
-	  modeStack.push_back( newElem );
-	  currentMode = inArray;
-	  currentGrammar = &arrayStartGrammar;
+	const char * stop = tokenEnd( pos, end );
+	if( stop == nullptr ){
+	  mPending.append( start, end - start );
+	  mStarted = true;
+	  break;
+	}
+	mLexing = lxBetween;
+	if( mPending.length() ){
+	  mPending.append( start, stop - start );
+	  dispatch( mPending );
+	  mPending.clear();
 	} else {
-	  if ( currentToken.type() == Token::tkEndObject ){
-	    if( modeStack.size() == 0 ) return false;
-	    ReaderStack st = *modeStack.rbegin();
-	    if( st.mType != ctObject ) return false;
-	    modeStack.pop_back();
-	    mEvents.EndObject();
-	    currentMode = st.mMode;
-	    currentGrammar = st.currentGrammar;
-	  } else if ( currentToken.type() == Token::tkEndArray ){
-	    if( modeStack.size() == 0 ) return false;
-	    ReaderStack st = *modeStack.rbegin();
-	    modeStack.pop_back();
-	    if( st.mType != ctArray ) return false;
-	    currentMode = st.mMode;
-	    currentGrammar = st.currentGrammar;
-	    mEvents.EndArray();
-	  }
-	  switch( currentMode ){
-	  case topValue:
-	    currentMode = done;
-	    currentGrammar = &nothingGrammar;
-	    break;
-	  case inObject:
-	  case inObjectGotComma:
-	    if( currentToken.type() == Token::tkString ){
-	      currentMode = inObjectGotKey;
-	      currentGrammar = &objectColonGrammar;
-	    }
-	    break;
-	  case inObjectGotKey:
-	    assert( currentToken.type() == Token::tkColon );
-	    currentMode = inObjectGotColon;
-	    currentGrammar = &valueGrammar;
-	    break;
-	  case inObjectGotValue:
-	    currentMode = inObjectCommaOrEnd;
-	    currentGrammar = &objectAfterValueGrammar;
-	    break;
-	  case inObjectGotColon:
-	    currentMode = inObjectCommaOrEnd;
-	    currentGrammar = &objectAfterValueGrammar;
-	    break;
-	  case inObjectCommaOrEnd:
-	    if( currentToken.type() ==Token::tkComma ){
-	      currentMode = inObjectGotComma;
-	      currentGrammar = &objectKeyGrammar;
-	    }
-	    break;
-	  case inArray:
-	  case inArrayGotComma:
-	    if( currentToken.isValue() ){
-	      currentMode = inArrayGotValue;
-	      currentGrammar = &arrayAfterValueGrammar;
-	    }
-	    break;
-	  case inArrayGotValue:
-	    if( currentToken.type() != Token::tkEndArray ) {
-	      currentMode = inArrayGotComma;
-	      currentGrammar = &valueGrammar;
-	    }
-	    break;
-	  }
+	  dispatch( std::string_view( start, stop - start ) );
 	}
+	pos = stop;
       }
-      if( mObjectDepth != 0 || modeStack.size() != 0 ){
-	return false;
+      return mStopped == false;
+    }
+    bool feed( std::string_view data )
+    {
+      return feed( data.data(), data.size() );
+    }
+    // end of input - the result Reader::read would give.
+    bool finish()
+    {
+      if( mStopped == false && mLexing != lxBetween ){
+	mLexing = lxBetween;
+	dispatch( mPending );
+	mPending.clear();
       }
-      return true;
+      if( mStopped ){
+	return mResult;
+      }
+      return mDispatcher.complete();
+    }
+    // any token, or part of one, has been seen.
+    bool started() const
+    {
+      return mStarted;
+    }
+    // the whole top level value has been read.
+    bool done() const
+    {
+      return mDispatcher.done();
+    }
+    // bytes held of a token split across chunks.
+    size_t pending() const
+    {
+      return mPending.length();
     }
   };
+
   class ReaderHandlerAllFail : public ReaderHandler
   {
   public:
@@ -682,6 +1285,543 @@ namespace json_lite {
     }
 
   };
+
+  //////////////////////////////////////////////////////////
+  // Writer - json text from the same calls a ReaderHandler gets,
+  // appended to out (so a Writer can be a Reader's handler).
+  // Commas are added as needed.  Strings are copied in runs
+  // between the characters which need escaping, found by the
+  // scan kernels.  Compact - no whitespace is written.
+  class Writer : public ReaderHandler
+  {
+    std::string & mOut;
+    std::vector< bool > mFirst; // per open object or array
+    bool mAfterKey;
+    const scan::Kernels * mScan;
+
+    void separator()
+    {
+      if( mAfterKey ){
+	mAfterKey = false;
+      } else if( mFirst.size() ){
+	if( mFirst.back() == false ){
+	  mOut += ',';
+	}
+	mFirst.back() = false;
+      }
+    }
+    void quoted( std::string_view text )
+    {
+      static const char hex[] = "0123456789abcdef";
+      mOut += '"';
+      const char * pos = text.data();
+      const char * end = pos + text.size();
+      while( pos != end ){
+	const char * stop = mScan->stringEnd( pos, end );
+	mOut.append( pos, stop - pos );
+	if( stop == end ) break;
+	switch( *stop ){
+	case '"': mOut += "\\\""; break;
+	case '\\': mOut += "\\\\"; break;
+	case '\n': mOut += "\\n"; break;
+	case '\r': mOut += "\\r"; break;
+	case '\t': mOut += "\\t"; break;
+	default:
+	  mOut += "\\u00";
+	  mOut += hex[ ( *stop >> 4 ) & 0xf ];
+	  mOut += hex[ *stop & 0xf ];
+	  break;
+	}
+	pos = stop + 1;
+      }
+      mOut += '"';
+    }
+    template< class T >
+    bool number( T value )
+    {
+      separator();
+      char text[ 32 ];
+      auto result = std::to_chars( text, text + sizeof( text ), value );
+      mOut.append( text, result.ptr - text );
+      return true;
+    }
+    bool literal( const char * text )
+    {
+      separator();
+      mOut += text;
+      return true;
+    }
+  public:
+    Writer( std::string & out )
+      : mOut( out )
+      , mAfterKey( false )
+      , mScan( &scan::bestKernels() )
+    {}
+    // every object and array has been closed.
+    bool complete() const
+    {
+      return mFirst.size() == 0;
+    }
+    bool Null() override
+    {
+      return literal( "null" );
+    }
+    bool Bool( bool b ) override
+    {
+      return literal( b ? "true" : "false" );
+    }
+    bool Int( int i ) override
+    {
+      return number( i );
+    }
+    bool Uint( unsigned u ) override
+    {
+      return number( u );
+    }
+    bool Int64( int64_t i ) override
+    {
+      return number( i );
+    }
+    bool Uint64( uint64_t u ) override
+    {
+      return number( u );
+    }
+    // shortest text which reads back as d, json has no inf or nan.
+    bool Double( double d ) override
+    {
+      if( d != d || d - d != 0 ){
+	return literal( "null" );
+      }
+      return number( d );
+    }
+    bool RawNumber( const char * str, size_t length ) override
+    {
+      separator();
+      mOut.append( str, length );
+      return true;
+    }
+    bool String( const char * str, size_t size ) override
+    {
+      separator();
+      quoted( std::string_view( str, size ) );
+      return true;
+    }
+    bool String( std::string_view text )
+    {
+      return String( text.data(), text.size() );
+    }
+    bool Key( const char * str, size_t length ) override
+    {
+      separator();
+      quoted( std::string_view( str, length ) );
+      mOut += ':';
+      mAfterKey = true;
+      return true;
+    }
+    bool Key( std::string_view text )
+    {
+      return Key( text.data(), text.size() );
+    }
+    bool StartObject() override
+    {
+      separator();
+      mOut += '{';
+      mFirst.push_back( true );
+      return true;
+    }
+    bool EndObject() override
+    {
+      mOut += '}';
+      mFirst.pop_back();
+      return true;
+    }
+    bool StartArray() override
+    {
+      separator();
+      mOut += '[';
+      mFirst.push_back( true );
+      return true;
+    }
+    bool EndArray() override
+    {
+      mOut += ']';
+      mFirst.pop_back();
+      return true;
+    }
+  };
+
+  //////////////////////////////////////////////////////////
+  // Arena - monotonic allocation from a few large blocks, which
+  // are all freed together.  Nothing allocated is destructed.
+  class Arena
+  {
+    std::vector< std::unique_ptr< char[] > > mBlocks;
+    char * mPos;
+    char * mEnd;
+    size_t mNextBlock;
+    size_t mReserved;
+    enum { firstBlock = 4096, largestBlock = 1024 * 1024 };
+  public:
+    Arena()
+      : mPos( nullptr )
+      , mEnd( nullptr )
+      , mNextBlock( firstBlock )
+      , mReserved( 0 )
+    {}
+    Arena( const Arena & ) = delete;
+    Arena & operator=( const Arena & ) = delete;
+    Arena( Arena && ) = default;
+    Arena & operator=( Arena && ) = default;
+    void * allocate( size_t size, size_t align = alignof( std::max_align_t ) )
+    {
+      uintptr_t pos = ( uintptr_t( mPos ) + align - 1 ) & ~uintptr_t( align - 1 );
+      if( mPos == nullptr || pos + size > uintptr_t( mEnd ) ){
+	size_t blockSize = std::max( mNextBlock, size + align );
+	mBlocks.emplace_back( new char[ blockSize ] );
+	mPos = mBlocks.back().get();
+	mEnd = mPos + blockSize;
+	mReserved += blockSize;
+	mNextBlock = std::min< size_t >( mNextBlock * 2, largestBlock );
+	pos = ( uintptr_t( mPos ) + align - 1 ) & ~uintptr_t( align - 1 );
+      }
+      mPos = (char *)( pos + size );
+      return (void *)pos;
+    }
+    template< class T >
+    T * allocate( size_t count )
+    {
+      return static_cast< T * >( allocate( sizeof( T ) * count, alignof( T ) ) );
+    }
+    std::string_view copy( std::string_view text )
+    {
+      char * data = static_cast< char * >( allocate( text.size(), 1 ) );
+      memcpy( data, text.data(), text.size() );
+      return std::string_view( data, text.size() );
+    }
+    void clear()
+    {
+      mBlocks.clear();
+      mPos = mEnd = nullptr;
+      mNextBlock = firstBlock;
+      mReserved = 0;
+    }
+    size_t blocks() const
+    {
+      return mBlocks.size();
+    }
+    size_t reserved() const
+    {
+      return mReserved;
+    }
+  };
+
+  //////////////////////////////////////////////////////////
+  // Value - a node of a Document.  Strings, array elements and
+  // object members are all in the Document's arena.
+  // Objects of more than a few members have a hash index of their
+  // keys, so find is O(1); duplicate keys find the first.
+  struct Member;
+  class Value
+  {
+  public:
+    enum Type { vtNull, vtBool, vtInt, vtUint, vtDouble,
+		vtString, vtArray, vtObject };
+  private:
+    friend class Document;
+    Type mType;
+    uint32_t mSize;
+    union {
+      bool mBool;
+      int64_t mInt;
+      uint64_t mUint;
+      double mDouble;
+      const char * mString;
+      Value * mElements;
+      Member * mMembers;
+    };
+    uint32_t * mIndex; // slots of member index + 1, 0 is empty
+    enum { indexedSize = 8 };
+    static uint32_t slots( uint32_t size )
+    {
+      uint32_t count = 16;
+      while( count < size * 2 ) count *= 2;
+      return count;
+    }
+  public:
+    Value( Type type = vtNull )
+      : mType( type )
+      , mSize( 0 )
+      , mInt( 0 )
+      , mIndex( nullptr )
+    {}
+    static uint32_t hash( std::string_view key )
+    {
+      uint32_t hash = 2166136261u;
+      for( size_t i = 0; i < key.size(); i++ ){
+	hash ^= (unsigned char)key[i];
+	hash *= 16777619u;
+      }
+      return hash;
+    }
+    Type type() const
+    {
+      return mType;
+    }
+    bool isNull() const { return mType == vtNull; }
+    bool isBool() const { return mType == vtBool; }
+    bool isNumber() const
+    {
+      return mType == vtInt || mType == vtUint || mType == vtDouble;
+    }
+    bool isString() const { return mType == vtString; }
+    bool isArray() const { return mType == vtArray; }
+    bool isObject() const { return mType == vtObject; }
+    bool asBool() const
+    {
+      return mType == vtBool && mBool;
+    }
+    int64_t asInt64() const
+    {
+      return mType == vtInt ? mInt
+	: mType == vtUint ? int64_t( mUint )
+	: mType == vtDouble ? int64_t( mDouble ) : 0;
+    }
+    uint64_t asUint64() const
+    {
+      return mType == vtUint ? mUint
+	: mType == vtInt ? uint64_t( mInt )
+	: mType == vtDouble ? uint64_t( mDouble ) : 0;
+    }
+    double asDouble() const
+    {
+      return mType == vtDouble ? mDouble
+	: mType == vtInt ? double( mInt )
+	: mType == vtUint ? double( mUint ) : 0;
+    }
+    std::string_view asString() const
+    {
+      return mType == vtString ? std::string_view( mString, mSize )
+	: std::string_view();
+    }
+    // elements of an array, members of an object.
+    size_t size() const
+    {
+      return mType == vtArray || mType == vtObject ? mSize : 0;
+    }
+    const Value & operator[]( size_t index ) const
+    {
+      assert( mType == vtArray && index < mSize );
+      return mElements[ index ];
+    }
+    inline const Member & member( size_t index ) const;
+    // the value of key in an object, nullptr if there is none.
+    inline const Value * find( std::string_view key ) const;
+  };
+
+  struct Member
+  {
+    std::string_view mKey;
+    Value mValue;
+  };
+
+  const Member & Value::member( size_t index ) const
+  {
+    assert( mType == vtObject && index < mSize );
+    return mMembers[ index ];
+  }
+
+  const Value * Value::find( std::string_view key ) const
+  {
+    if( mType != vtObject ) return nullptr;
+    if( mIndex == nullptr ){
+      for( uint32_t i = 0; i < mSize; i++ ){
+	if( mMembers[i].mKey == key ) return &mMembers[i].mValue;
+      }
+      return nullptr;
+    }
+    uint32_t mask = slots( mSize ) - 1;
+    for( uint32_t slot = hash( key ) & mask; mIndex[ slot ];
+	 slot = ( slot + 1 ) & mask ){
+      const Member & candidate = mMembers[ mIndex[ slot ] - 1 ];
+      if( candidate.mKey == key ) return &candidate.mValue;
+    }
+    return nullptr;
+  }
+
+  //////////////////////////////////////////////////////////
+  // Document - a whole json document in an Arena, built from the
+  // reader's events.  Either parse( text ), or pass the Document
+  // as the handler of any Reader.
+  class Document : public ReaderHandler
+  {
+    Arena mArena;
+    // values of the open arrays and objects, and the value
+    // for each which is being filled.
+    std::vector< Member > mStack;
+    std::vector< size_t > mOpen;
+    std::string_view mKey;
+    std::string mError;
+    Value mNull;
+
+    bool add( const Value & value )
+    {
+      mStack.push_back( Member{ mKey, value } );
+      mKey = std::string_view();
+      return true;
+    }
+    bool start( Value::Type type )
+    {
+      mOpen.push_back( mStack.size() );
+      return add( Value( type ) );
+    }
+    bool end( Value::Type type )
+    {
+      if( mOpen.size() == 0 || mStack[ mOpen.back() ].mValue.mType != type ){
+	mError = "Mismatched end";
+	return false;
+      }
+      size_t first = mOpen.back() + 1;
+      uint32_t count = mStack.size() - first;
+      Value & container = mStack[ first - 1 ].mValue;
+      container.mSize = count;
+      if( type == Value::vtArray ){
+	container.mElements = mArena.allocate< Value >( count );
+	for( uint32_t i = 0; i < count; i++ ){
+	  new ( &container.mElements[i] ) Value( mStack[ first + i ].mValue );
+	}
+      } else {
+	container.mMembers = mArena.allocate< Member >( count );
+	for( uint32_t i = 0; i < count; i++ ){
+	  new ( &container.mMembers[i] ) Member( mStack[ first + i ] );
+	}
+	if( count > Value::indexedSize ){
+	  uint32_t slots = Value::slots( count );
+	  container.mIndex = mArena.allocate< uint32_t >( slots );
+	  memset( container.mIndex, 0, slots * sizeof( uint32_t ) );
+	  for( uint32_t i = 0; i < count; i++ ){
+	    uint32_t slot = Value::hash( container.mMembers[i].mKey ) & ( slots - 1 );
+	    while( container.mIndex[ slot ] ) slot = ( slot + 1 ) & ( slots - 1 );
+	    container.mIndex[ slot ] = i + 1;
+	  }
+	}
+      }
+      mStack.resize( first );
+      mOpen.pop_back();
+      return true;
+    }
+  public:
+    Document()
+    {}
+    Document( const Document & ) = delete;
+    Document & operator=( const Document & ) = delete;
+    // parse text, replacing any previous document.
+    bool parse( std::string_view text )
+    {
+      clear();
+      BufferInputStream stream( text );
+      BufferReader rdr( *this, stream, true );
+      if( rdr.read( true ) == false || mError.length() ){
+	if( mError.length() == 0 ){
+	  mError = "Invalid json";
+	}
+	return false;
+      }
+      return true;
+    }
+    void clear()
+    {
+      mArena.clear();
+      mStack.clear();
+      mOpen.clear();
+      mKey = std::string_view();
+      mError.clear();
+    }
+    // a null Value until a whole document has been read.
+    const Value & root() const
+    {
+      if( mStack.size() == 1 && mOpen.size() == 0 ){
+	return mStack[0].mValue;
+      }
+      return mNull;
+    }
+    const std::string & error() const
+    {
+      return mError;
+    }
+    const Arena & arena() const
+    {
+      return mArena;
+    }
+
+    bool Null() override
+    {
+      return add( Value() );
+    }
+    bool Bool( bool b ) override
+    {
+      Value value( Value::vtBool );
+      value.mBool = b;
+      return add( value );
+    }
+    bool Int( int i ) override
+    {
+      return Int64( i );
+    }
+    bool Uint( unsigned u ) override
+    {
+      return Int64( u );
+    }
+    bool Int64( int64_t i ) override
+    {
+      Value value( Value::vtInt );
+      value.mInt = i;
+      return add( value );
+    }
+    bool Uint64( uint64_t u ) override
+    {
+      Value value( Value::vtUint );
+      value.mUint = u;
+      return add( value );
+    }
+    bool Double( double d ) override
+    {
+      Value value( Value::vtDouble );
+      value.mDouble = d;
+      return add( value );
+    }
+    bool String( const char * str, size_t size ) override
+    {
+      Value value( Value::vtString );
+      value.mString = mArena.copy( std::string_view( str, size ) ).data();
+      value.mSize = size;
+      return add( value );
+    }
+    bool RawNumber( const char *, size_t ) override
+    {
+      return true;
+    }
+    bool Key( const char * str, size_t length ) override
+    {
+      mKey = mArena.copy( std::string_view( str, length ) );
+      return true;
+    }
+    bool StartObject() override
+    {
+      return start( Value::vtObject );
+    }
+    bool EndObject() override
+    {
+      return end( Value::vtObject );
+    }
+    bool StartArray() override
+    {
+      return start( Value::vtArray );
+    }
+    bool EndArray() override
+    {
+      return end( Value::vtArray );
+    }
+  };
 };
 #endif
 
@@ -0,0 +1,183 @@
+#include <errno.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "options.h"
+
+struct option config_edit_options[] =
+  {
+   { "platform", required_argument, nullptr, 'p'},
+   { "edid",     required_argument, nullptr, 'e'},
+   { "all",      no_argument,       nullptr, 0 }, 
+   { "add",      required_argument, nullptr, 'a'},
+   { "remove",   required_argument, nullptr, 'r'},
+   { "comment",  required_argument, nullptr, 'c'},
+   { "file",     required_argument, nullptr, 'f'},
+   { "print",    no_argument,       nullptr, 0 },
+   { "gpio",     required_argument, nullptr, 'g' },
+   { "config",   required_argument, nullptr, 0 },
+   { "hdmi",     required_argument, nullptr, 0 },
+   { "keepbackup", no_argument,     nullptr, 0 },
+   { "help",     no_argument,       nullptr, 0 },
+   { "batch",    required_argument, nullptr, 0 },
+   { "jobs",     required_argument, nullptr, 'j' },
+   { "daemon",   required_argument, nullptr, 0 },
+   { "report",   no_argument,       nullptr, 0 },
+   { "json",     no_argument,       nullptr, 0 },
+   { "then",     no_argument,       nullptr, 0 },
+   { nullptr,    0,                 nullptr, 0 },
+  };
+
+Options::Options()
+  : file( "/boot/config.txt" )
+  , bInvalid( false )
+  , bHelp( false )
+  , bPrintMode( false )
+  , bJson( false )
+  , bKeepBackup( false )
+  , bReport( false )
+  , groups( 1 )
+  , threads( std::thread::hardware_concurrency() )
+{}
+
+//////////////////////////////////////////////////////////
+// getopt_long only sets opt_idx for long options, find the
+// entry for a short one.
+static int optionIndex( int c, int opt_idx )
+{
+  if( c == 0 ) return opt_idx;
+  for( int i = 0; config_edit_options[i].name; i++ ){
+    if( config_edit_options[i].val == c ){
+      return i;
+    }
+  }
+  return opt_idx;
+}
+
+//////////////////////////////////////////////////////////
+// a whole decimal number from 1 to max, reported as getopt reports
+// a bad option.
+static const unsigned maxThreads = 1024;
+static bool parseCount( const char * program, const char * option,
+			const char * text, unsigned max, unsigned & value )
+{
+  char * end = nullptr;
+  errno = 0;
+  unsigned long number = strtoul( text, &end, 10 );
+  if( *text < '0' || *text > '9' || *end != '\0' || errno == ERANGE ||
+      number == 0 || number > max ){
+    std::cerr << program << ": option '--" << option << "' needs a number"
+	      << " from 1 to " << max << ", not '" << text << "'" << std::endl;
+    return false;
+  }
+  value = number;
+  return true;
+}
+
+bool parseOptions( int argc, char * argv[], Options & options )
+{
+  optind = 0; // glibc - restart the scan from argv[1]
+  while ( options.bInvalid == false) {
+    int opt_idx = 0;
+    int c = getopt_long( argc, argv, "p:e:a:r:c:f:g:j:",
+			 config_edit_options, &opt_idx);
+    if( c == -1 ) {
+      break;
+    }
+    switch( c ){
+    case '?':
+      options.bInvalid = true;
+      break;
+    case 'f':
+      options.file = optarg;
+      break;
+    case 0:
+    default:
+      {
+	std::string option = config_edit_options[ optionIndex( c, opt_idx ) ].name;
+	Actions & actions = options.groups.back();
+	if( option == "print" ){
+	  options.bPrintMode = true;
+	} else if( option == "json" ){
+	  options.bJson = true;
+	} else if( option == "platform" ||
+		   option == "edid" ||
+		   option == "gpio" ||
+		   option == "cpuserial" ){
+	  Filter flt( optarg, option.c_str() );
+	  actions.requiredFilters.push_back( flt );
+	} else if( option == "add" ) {
+	  actions.addCommands.push_back( optarg );
+	} else if ( option == "remove" ) {
+	  actions.removeCommands.push_back( optarg );
+	} else if ( option == "comment" ) {
+	  actions.commentCommands.push_back( optarg );
+	} else if( option == "then" ) {
+	  options.groups.push_back( Actions() );
+	} else if( option == "keepbackup" ) {
+	  options.bKeepBackup = true;
+	} else if( option == "help" ){
+	  options.bHelp = true;
+	} else if( option == "batch" ){
+	  options.manifest = optarg;
+	} else if( option == "jobs" ){
+	  if( parseCount( argv[0], "jobs", optarg, maxThreads,
+			  options.threads ) == false ){
+	    options.bInvalid = true;
+	  }
+	} else if( option == "daemon" ){
+	  options.socketPath = optarg;
+	} else if( option == "report" ){
+	  options.bReport = true;
+	} else if( option == "config" ){
+	  options.configFile = optarg;
+	}
+	break;
+      }
+    }
+  }
+  // a trailing --then starts nothing.
+  if( options.groups.size() > 1 ){
+    const Actions & last = options.groups.back();
+    if( last.requiredFilters.empty() && last.addCommands.empty() &&
+	last.removeCommands.empty() && last.commentCommands.empty() ){
+      options.groups.pop_back();
+    }
+  }
+  return options.bInvalid == false;
+}
+
+bool parseOptions( const std::vector< std::string > & args, Options & options )
+{
+  // getopt wants a mutable, null terminated argv.
+  std::vector< std::string > copies( args );
+  std::vector< char * > argv;
+  for( auto it = copies.begin(); it != copies.end(); it++ ){
+    argv.push_back( &(*it)[0] );
+  }
+  argv.push_back( nullptr );
+  return parseOptions( argv.size() - 1, argv.data(), options );
+}
+
+bool validateFilters( const ConfigSetup & cfg,
+		      const std::vector< Actions > & groups,
+		      std::string & error )
+{
+  for( auto actions = groups.begin(); actions != groups.end(); actions++ ){
+    for( auto it = actions->requiredFilters.begin(); it != actions->requiredFilters.end(); it++ ){
+      std::string key = it->mKey;
+      if( it->mValue.length() > 0 ){
+	key+= "=";
+	key+= it->mValue;
+      }
+      if( !cfg.findValue( std::string_view( it->mKey ) ) ){
+	error = "Invalid filter '" + key + "'";
+	return false;
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,38 @@
+//////////////////////////////////////////////////////////
+//  options - the command line of config_edit.
+//  Shared by main, and the server which takes the same
+//  options for each request.
+#pragma once
+#if ! defined( H_OPTIONS_H)
+#define H_OPTIONS_H
+#include <getopt.h>
+#include <string>
+#include <vector>
+#include "config_edit.h"
+
+extern struct option config_edit_options[];
+
+struct Options
+{
+  std::string file;
+  bool bInvalid;
+  bool bHelp;
+  bool bPrintMode;
+  bool bJson;               // --print as json
+  bool bKeepBackup;
+  bool bReport;             // bytes written by each edit
+  std::vector< Actions > groups; // split by --then
+  std::string manifest;     // --batch
+  unsigned threads;         // --jobs
+  std::string socketPath;   // --daemon
+  std::string configFile;   // --config
+  Options();
+};
+bool parseOptions( int argc, char * argv[], Options & options );
+// args[0] is the program name, as in argv.
+bool parseOptions( const std::vector< std::string > & args, Options & options );
+// ensure all the Filters added to each group are valid.
+bool validateFilters( const ConfigSetup & cfg,
+		      const std::vector< Actions > & groups,
+		      std::string & error );
+#endif
@@ -0,0 +1,94 @@
+//////////////////////////////////////////////////////////
+//  work pool - runs indexed jobs over a set of threads.
+#pragma once
+#if ! defined( H_WORK_POOL_H)
+#define H_WORK_POOL_H
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////
+// WorkPool
+// run( count, job ) calls job( 0 ) ... job( count - 1 ) across
+// mThreads threads, and returns when all have finished.
+// Each worker starts with its own contiguous block of the jobs,
+// taken from the back of its queue.  A worker whose queue is empty
+// steals from the front of another worker's queue, so a few slow
+// jobs don't leave the other threads idle.
+class WorkPool
+{
+  struct Queue {
+    std::mutex mLock;
+    std::deque< size_t > mJobs;
+  };
+  unsigned mThreads;
+  std::vector< std::unique_ptr< Queue > > mQueues;
+
+  bool popOwn( size_t worker, size_t & job )
+  {
+    Queue & q = *mQueues[ worker ];
+    std::lock_guard< std::mutex > lock( q.mLock );
+    if( q.mJobs.size() == 0 ) return false;
+    job = q.mJobs.back();
+    q.mJobs.pop_back();
+    return true;
+  }
+  bool steal( size_t worker, size_t & job )
+  {
+    for( size_t i = 1; i < mQueues.size(); i++ ){
+      Queue & q = *mQueues[ ( worker + i ) % mQueues.size() ];
+      std::lock_guard< std::mutex > lock( q.mLock );
+      if( q.mJobs.size() ){
+	job = q.mJobs.front();
+	q.mJobs.pop_front();
+	return true;
+      }
+    }
+    return false;
+  }
+  void work( size_t worker, const std::function< void( size_t ) > & job )
+  {
+    size_t next;
+    while( popOwn( worker, next ) || steal( worker, next ) ){
+      job( next );
+    }
+  }
+public:
+  WorkPool( unsigned threads )
+    : mThreads( threads ? threads : 1 )
+  {}
+  void run( size_t count, const std::function< void( size_t ) > & job )
+  {
+    size_t threads = std::min< size_t >( mThreads, count );
+    if( threads <= 1 ){
+      for( size_t i = 0; i < count; i++ ){
+	job( i );
+      }
+      return;
+    }
+    mQueues.clear();
+    for( size_t t = 0; t < threads; t++ ){
+      mQueues.emplace_back( new Queue );
+      // owner pops from the back, so queue its block in reverse.
+      size_t first = count * t / threads;
+      size_t last = count * ( t + 1 ) / threads;
+      for( size_t i = last; i > first; i-- ){
+	mQueues[ t ]->mJobs.push_back( i - 1 );
+      }
+    }
+    std::vector< std::thread > workers;
+    for( size_t t = 1; t < threads; t++ ){
+      workers.emplace_back( [this, t, &job]() { work( t, job ); } );
+    }
+    work( 0, job );
+    for( auto & w : workers ){
+      w.join();
+    }
+    mQueues.clear();
+  }
+};
+#endif